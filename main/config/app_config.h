@@ -11,6 +11,57 @@
 
 #define APP_CONFIG_BASE_TASK_STACK_SIZE 512
 
+#define APP_CONFIG_MINION_TASK_PRIORITY      10
+#define APP_CONFIG_PERSISTENCE_TASK_PRIORITY 2
+#define APP_CONFIG_DIGIN_TASK_PRIORITY       5
+
+// Settings changed within this window after the first one are written to flash together
+#define APP_CONFIG_PERSISTENCE_BATCH_MS 100
+// Flash writes wait for an idle bus (see controller/bus_activity.c), but never longer than this
+#define APP_CONFIG_PERSISTENCE_IDLE_DEADLINE_MS 2000
+// A failed flash write is tried again after this long, the change stays pending meanwhile
+#define APP_CONFIG_PERSISTENCE_RETRY_MS 1000
+// Silence after which the bus is considered idle even without a response of ours
+#define APP_CONFIG_BUS_QUIET_MS 20
+
+// Work seconds survive warm resets in RTC memory, flash is only a checkpoint against power loss
+#define APP_CONFIG_WORK_SECONDS_CHECKPOINT_MS (5UL * 60UL * 1000UL)
+
+// The main loop sleeps between events, these are its only periodic wake ups
+#define APP_CONFIG_LEDS_PERIOD_MS     20
+#define APP_CONFIG_RETAINED_PERIOD_MS 1000
+
+// Time allowed for the first valid frame after a baud rate change before going back to the default
+#define APP_CONFIG_BAUDRATE_FALLBACK_MS 5000
+
+// Detect the bus speed at boot by listening for valid frames on every supported baud rate
+#define APP_CONFIG_AUTOBAUD           0
+#define APP_CONFIG_AUTOBAUD_WINDOW_MS 500
+#define APP_CONFIG_AUTOBAUD_ROUNDS    4
+
 #define APP_CONFIG_HARDWARE_MODEL EASYCONNECT_DEVICE_RELE_PERIPHERAL
 
+// Inputs are captured on every edge and take a new level once they stay still for this long
+#define APP_CONFIG_DIGIN_DEBOUNCE_US 20000
+
+/*
+ *  Feedback confirmation: accepted as soon as the feedback input matches for this long, the feedback delay is
+ *  only the timeout; 0 samples the feedback once at the end of the delay.
+ *  Fixed at build time on purpose: it depends on the bounce of the relay contacts on the board, not on the
+ *  installation, and the runtime tuning is the feedback delay.
+ */
+#define APP_CONFIG_FEEDBACK_STABLE_MS 100
+
+// Relay outputs driven by the board, up to 8 (see HAP_RELE_OUTPUTS and HAP_RELE_FEEDBACKS)
+#define APP_CONFIG_RELE_CHANNELS 1
+
+/*
+ *  Modbus CRC implementation (see utils/crc16.h); the BenchCRC command compares them on the target
+ */
+#ifdef ESP_PLATFORM
+#define APP_CONFIG_CRC16_IMPLEMENTATION CRC16_IMPLEMENTATION_TABLE
+#else
+#define APP_CONFIG_CRC16_IMPLEMENTATION CRC16_IMPLEMENTATION_SLICE_BY_4
+#endif
+
 #endif
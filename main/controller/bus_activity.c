@@ -0,0 +1,71 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "gel/timer/timecheck.h"
+#include "utils/utils.h"
+#include "config/app_config.h"
+#include "bus_activity.h"
+
+
+/*
+ *  Tracks the Modbus traffic seen by the minion to find the moments when a flash operation (which stalls the
+ *  cache and can delay the UART interrupt) is least likely to overlap a frame.
+ *  The best window opens right after our own response, while the master is busy processing it; a bus that has been
+ *  quiet for a while is idle as well.
+ */
+static struct {
+    SemaphoreHandle_t      response_sent;
+    StaticSemaphore_t      semaphore_buffer;
+    volatile unsigned long last_rx;
+} bus = {0};
+
+
+void bus_activity_init(void) {
+    bus.response_sent = xSemaphoreCreateBinaryStatic(&bus.semaphore_buffer);
+    bus.last_rx       = get_millis();
+}
+
+
+/*
+ *  Called by the minion for every chunk received from the bus, whoever it is addressed to
+ */
+void bus_activity_received(void) {
+    bus.last_rx = get_millis();
+}
+
+
+/*
+ *  Called by the minion once our response has completely left the transmitter
+ */
+void bus_activity_response_sent(void) {
+    xSemaphoreGive(bus.response_sent);
+}
+
+
+/*
+ *  Blocks until the bus is idle; returns 0 when an idle window was found, -1 if the timeout expired first
+ */
+int bus_activity_wait_idle(unsigned long timeout_ms) {
+    unsigned long start = get_millis();
+
+    // Only a response sent from now on opens a window
+    xSemaphoreTake(bus.response_sent, 0);
+
+    for (;;) {
+        if (is_expired(bus.last_rx, get_millis(), APP_CONFIG_BUS_QUIET_MS)) {
+            return 0;
+        }
+
+        unsigned long elapsed = time_interval(start, get_millis());
+        if (elapsed >= timeout_ms) {
+            return -1;
+        }
+
+        unsigned long wait = timeout_ms - elapsed;
+        if (wait > APP_CONFIG_BUS_QUIET_MS) {
+            wait = APP_CONFIG_BUS_QUIET_MS;
+        }
+        if (xSemaphoreTake(bus.response_sent, pdMS_TO_TICKS(wait)) == pdTRUE) {
+            return 0;
+        }
+    }
+}
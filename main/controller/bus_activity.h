@@ -0,0 +1,11 @@
+#ifndef BUS_ACTIVITY_H_INCLUDED
+#define BUS_ACTIVITY_H_INCLUDED
+
+
+void bus_activity_init(void);
+void bus_activity_received(void);
+void bus_activity_response_sent(void);
+int  bus_activity_wait_idle(unsigned long timeout_ms);
+
+
+#endif
@@ -1,10 +1,21 @@
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
+#include "config/app_config.h"
 #include "model/model.h"
 #include "peripherals/storage.h"
+#include "peripherals/work_journal.h"
+#include "peripherals/retained.h"
+#include "utils/crc16.h"
+#include "utils/utils.h"
+#include "gel/timer/timecheck.h"
 #include "easyconnect_interface.h"
+#include "bus_activity.h"
 #include "configuration.h"
 
 
@@ -18,65 +29,161 @@
 #define SAFETY_MESSAGE_KEY      "SAFETYMSG"
 #define FEEDBACK_MESSAGE_KEY    "FEEDBACKMSG"
 #define WORK_SECONDS_KEY        "WORKSECS"
+#define COMPATIBILITY_KEY       "COMPATIBILITY"
+
+
+#define CONFIGURATION_RECORD_KEY     "CONFIG"
+#define CONFIGURATION_RECORD_VERSION 1
+
+// Settings waiting to be written to flash
+#define DIRTY_RECORD       0x01
+#define DIRTY_WORK_SECONDS 0x02
+
+
+/*
+ *  Whole persistent configuration, stored as a single blob and loaded with one read.
+ *  Work seconds change all the time and are appended to their own journal (see peripherals/work_journal.h)
+ *  so that the record is rewritten only when the configuration actually changes.
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t version;
+    uint16_t address;
+    uint16_t class;
+    uint32_t serial_number;
+    uint8_t  feedback_enabled;
+    uint8_t  feedback_direction;
+    uint8_t  output_attempts;
+    uint8_t  feedback_delay;
+    char     safety_message[EASYCONNECT_MESSAGE_SIZE + 1];
+    char     feedback_message[EASYCONNECT_MESSAGE_SIZE + 1];
+    // Modbus CRC of all the previous fields
+    uint16_t crc;
+} configuration_record_t;
+
+
+typedef int (*migration_t)(model_t *pmodel);
+
+
+static void     persistence_task(void *args);
+static uint8_t  migrate(model_t *pmodel);
+static int      migrate_keys_to_record(model_t *pmodel);
+static void     mark_dirty(uint16_t dirty);
+static void     work_seconds_changed(void *arg, uint32_t changes);
+static uint8_t  work_seconds_checkpoint_due(TickType_t *delay);
+static int      load_record(model_t *pmodel);
+static void     load_legacy_keys(model_t *pmodel);
+static int      save_record(model_t *pmodel);
+static uint16_t record_crc(const configuration_record_t *record);
 
 
 static const char *TAG = "Config";
 
+/*
+ *  Ordered upgrade steps of the stored configuration: migrations[i] brings it from version i + 1 to version i + 2.
+ *  A layout change appends a step here, the stored data is never erased.
+ */
+static const migration_t migrations[] = {
+    migrate_keys_to_record,
+};
 
-void configuration_init(model_t *pmodel) {
-    uint16_t value       = 0;
-    uint32_t value_32bit = 0;
+#define COMPATIBILITY_VERSION (1 + sizeof(migrations) / sizeof(migrations[0]))
+// First version storing the configuration record; from here on the legacy keys are stale
+#define RECORD_COMPATIBILITY_VERSION 2
 
-    if (load_uint16_option(&value, ADDRESS_KEY) == 0) {
-        model_set_address(pmodel, value);
-    }
-    if (load_uint32_option(&value_32bit, SERIAL_NUM_KEY) == 0) {
-        model_set_serial_number(pmodel, value_32bit);
-    }
-    if (load_uint32_option(&value_32bit, WORK_SECONDS_KEY) == 0) {
-        model_set_work_seconds(pmodel, value_32bit);
-    }
-    if (load_uint16_option(&value, MODEL_KEY) == 0) {
-        model_set_class(pmodel, value, NULL);
-    }
+/*
+ *  Write-behind queue: changes are applied to the model right away and written to flash by a background task
+ */
+static struct {
+    model_t          *pmodel;
+    SemaphoreHandle_t sem;
+    StaticSemaphore_t semaphore_buffer;
+    TaskHandle_t      task;
+    uint16_t          dirty;
+    // Settings being written right now
+    uint16_t flushing;
+    // Time of the last work seconds checkpoint, if any
+    unsigned long work_seconds_ts;
+    uint8_t       work_seconds_saved;
+} persistence = {0};
 
-    load_blob_option(pmodel->safety_message, sizeof(pmodel->safety_message), SAFETY_MESSAGE_KEY);
-    load_blob_option(pmodel->feedback_message, sizeof(pmodel->feedback_message), FEEDBACK_MESSAGE_KEY);
 
-    uint8_t uint8_value = 0;
-    if (load_uint8_option(&uint8_value, FEEDBACK_ENABLE_KEY) == 0) {
-        model_set_feedback_enabled(pmodel, uint8_value);
+void configuration_init(model_t *pmodel) {
+    uint32_t work_seconds = 0;
+    if (work_journal_load(&work_seconds) == 0) {
+        model_set_work_seconds(pmodel, work_seconds);
+    } else if (load_uint32_option(&work_seconds, WORK_SECONDS_KEY) == 0) {
+        // Counter saved by a firmware without the journal, or journal unavailable
+        model_set_work_seconds(pmodel, work_seconds);
     }
 
-    if (load_uint8_option(&uint8_value, FEEDBACK_DIRECTION_KEY) == 0) {
-        model_set_feedback_direction(pmodel, uint8_value);
+    uint8_t             restored = 0;
+    retained_counters_t counters = {0};
+    if (retained_load(&counters) == 0) {
+        // Warm reset: the retained counters are newer than any flash checkpoint
+        ESP_LOGI(TAG, "Restoring %i work seconds after reset", (int)counters.work_seconds);
+        model_set_work_seconds(pmodel, counters.work_seconds);
+        model_set_output_attempts_exceeded(pmodel, counters.output_attempts_exceeded);
+        restored = 1;
     }
-    if (load_uint8_option(&uint8_value, ACTIVATION_ATTEMPTS_KEY) == 0) {
-        model_set_output_attempts(pmodel, uint8_value);
+
+    uint8_t version = migrate(pmodel);
+
+    if (load_record(pmodel)) {
+        if (version < RECORD_COMPATIBILITY_VERSION) {
+            // The keys were not migrated yet, they are still the current configuration
+            ESP_LOGW(TAG, "No valid configuration record, loading the legacy keys");
+            load_legacy_keys(pmodel);
+        } else {
+            // The keys left behind by the migration may be long outdated, better the defaults
+            ESP_LOGW(TAG, "No valid configuration record, using the defaults");
+        }
+        if (save_record(pmodel) == 0) {
+            storage_commit();
+        }
     }
-    if (load_uint8_option(&uint8_value, FEEDBACK_DELAY_KEY) == 0) {
-        model_set_feedback_delay(pmodel, uint8_value);
+
+    persistence.pmodel = pmodel;
+    persistence.sem    = xSemaphoreCreateMutexStatic(&persistence.semaphore_buffer);
+
+    static uint8_t      stack_buffer[APP_CONFIG_BASE_TASK_STACK_SIZE * 6];
+    static StaticTask_t task_buffer;
+    persistence.task = xTaskCreateStatic(persistence_task, "Persistence", sizeof(stack_buffer), NULL,
+                                         APP_CONFIG_PERSISTENCE_TASK_PRIORITY, stack_buffer, &task_buffer);
+
+    // What was just loaded is already in flash, only later changes are worth a write
+    model_take_changes(pmodel);
+    model_subscribe(pmodel, MODEL_CHANGED(MODEL_FIELD_WORK_SECONDS), work_seconds_changed, NULL);
+    if (restored) {
+        mark_dirty(DIRTY_WORK_SECONDS);
     }
 
     ESP_LOGI(TAG, "Configuration initialized");
 }
 
 
-void configuration_save_work_seconds(uint32_t value) {
-    save_uint32_option(&value, WORK_SECONDS_KEY);
+/*
+ *  Persistence status: CONFIGURATION_PENDING while some configuration change has not been written to flash yet,
+ *  CONFIGURATION_FLUSHED otherwise.
+ *  Work seconds are left out: they are pending most of the time while the relay is on, waiting for the checkpoint.
+ */
+uint16_t configuration_get_persistence_status(void) {
+    xSemaphoreTake(persistence.sem, portMAX_DELAY);
+    uint16_t status =
+        ((persistence.dirty | persistence.flushing) & DIRTY_RECORD) ? CONFIGURATION_PENDING : CONFIGURATION_FLUSHED;
+    xSemaphoreGive(persistence.sem);
+    return status;
 }
 
 
 void configuration_save_serial_number(void *args, uint32_t value) {
-    save_uint32_option(&value, SERIAL_NUM_KEY);
     model_set_serial_number(args, value);
+    mark_dirty(DIRTY_RECORD);
 }
 
 
 int configuration_save_class(void *args, uint16_t value) {
-    uint16_t corrected;
-    if (model_set_class(args, value, &corrected) == 0) {
-        save_uint16_option(&corrected, MODEL_KEY);
+    if (model_set_class(args, value, NULL) == 0) {
+        mark_dirty(DIRTY_RECORD);
         return 0;
     } else {
         return -1;
@@ -85,42 +192,284 @@ int configuration_save_class(void *args, uint16_t value) {
 
 
 void configuration_save_address(void *args, uint16_t value) {
-    save_uint16_option(&value, ADDRESS_KEY);
     model_set_address(args, value);
+    mark_dirty(DIRTY_RECORD);
 }
 
 
 void configuration_save_feedback_direction(void *args, uint8_t value) {
-    save_uint8_option(&value, FEEDBACK_DIRECTION_KEY);
     model_set_feedback_direction(args, value);
+    mark_dirty(DIRTY_RECORD);
 }
 
 
 void configuration_save_activation_attempts(void *args, uint8_t value) {
-    save_uint8_option(&value, ACTIVATION_ATTEMPTS_KEY);
     model_set_output_attempts(args, value);
+    mark_dirty(DIRTY_RECORD);
 }
 
 
 void configuration_save_feedback_delay(void *args, uint8_t value) {
-    save_uint8_option(&value, FEEDBACK_DELAY_KEY);
     model_set_feedback_delay(args, value);
+    mark_dirty(DIRTY_RECORD);
 }
 
 
 void configuration_save_feedback_enable(void *args, uint8_t value) {
-    save_uint8_option(&value, FEEDBACK_ENABLE_KEY);
     model_set_feedback_enabled(args, value);
+    mark_dirty(DIRTY_RECORD);
 }
 
 
 void configuration_save_safety_message(void *args, const char *string) {
-    save_blob_option((char *)string, strlen(string), SAFETY_MESSAGE_KEY);
     model_set_safety_message(args, string);
+    mark_dirty(DIRTY_RECORD);
 }
 
 
 void configuration_save_feedback_message(void *args, const char *string) {
-    save_blob_option((char *)string, strlen(string), FEEDBACK_MESSAGE_KEY);
     model_set_feedback_message(args, string);
+    mark_dirty(DIRTY_RECORD);
+}
+
+
+static void mark_dirty(uint16_t dirty) {
+    xSemaphoreTake(persistence.sem, portMAX_DELAY);
+    persistence.dirty |= dirty;
+    xSemaphoreGive(persistence.sem);
+    xTaskNotifyGive(persistence.task);
+}
+
+
+static void work_seconds_changed(void *arg, uint32_t changes) {
+    (void)arg;
+    (void)changes;
+    mark_dirty(DIRTY_WORK_SECONDS);
+}
+
+
+static void persistence_task(void *args) {
+    (void)args;
+    TickType_t timeout = portMAX_DELAY;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, timeout);
+        // Give related changes (e.g. a whole configuration sequence) the chance to land in the same batch
+        vTaskDelay(pdMS_TO_TICKS(APP_CONFIG_PERSISTENCE_BATCH_MS));
+
+        xSemaphoreTake(persistence.sem, portMAX_DELAY);
+        uint16_t dirty = persistence.dirty;
+        timeout        = portMAX_DELAY;
+        if ((dirty & DIRTY_WORK_SECONDS) && !work_seconds_checkpoint_due(&timeout)) {
+            // Stays pending until the checkpoint is due
+            dirty &= ~DIRTY_WORK_SECONDS;
+        }
+        persistence.dirty &= ~dirty;
+        persistence.flushing = dirty;
+        xSemaphoreGive(persistence.sem);
+
+        if (dirty == 0) {
+            continue;
+        }
+
+        // Flash operations stall the cache, keep them away from frames on the bus
+        if (bus_activity_wait_idle(APP_CONFIG_PERSISTENCE_IDLE_DEADLINE_MS)) {
+            ESP_LOGD(TAG, "No idle window on the bus, writing anyway");
+        }
+
+        uint16_t failed = 0;
+
+        // The current model values are written, so repeated changes cost a single write
+        if (dirty & DIRTY_RECORD) {
+            // A single commit for the whole batch
+            if (save_record(persistence.pmodel) || storage_commit()) {
+                failed |= DIRTY_RECORD;
+            }
+        }
+        if (dirty & DIRTY_WORK_SECONDS) {
+            uint32_t value = model_get_work_seconds(persistence.pmodel);
+            ESP_LOGI(TAG, "Saving %i seconds", (int)value);
+            int res = work_journal_append(value);
+            if (res) {
+                // Journal unavailable, fall back to NVS so that the counter is not lost
+                res = save_uint32_option(&value, WORK_SECONDS_KEY) || storage_commit();
+            }
+            if (res) {
+                // The checkpoint stays due
+                failed |= DIRTY_WORK_SECONDS;
+            } else {
+                persistence.work_seconds_ts    = get_millis();
+                persistence.work_seconds_saved = 1;
+            }
+        }
+
+        xSemaphoreTake(persistence.sem, portMAX_DELAY);
+        persistence.flushing = 0;
+        // Pending again until a write succeeds
+        persistence.dirty |= failed;
+        xSemaphoreGive(persistence.sem);
+
+        if (failed) {
+            ESP_LOGW(TAG, "Flash write failed, retrying in %i ms", APP_CONFIG_PERSISTENCE_RETRY_MS);
+            if (timeout > pdMS_TO_TICKS(APP_CONFIG_PERSISTENCE_RETRY_MS)) {
+                timeout = pdMS_TO_TICKS(APP_CONFIG_PERSISTENCE_RETRY_MS);
+            }
+        }
+    }
+
+    vTaskDelete(NULL);
+}
+
+
+/*
+ *  Work seconds are checkpointed at most once every APP_CONFIG_WORK_SECONDS_CHECKPOINT_MS;
+ *  if the checkpoint is not due yet `delay` is set to the ticks left
+ */
+static uint8_t work_seconds_checkpoint_due(TickType_t *delay) {
+    if (!persistence.work_seconds_saved ||
+        is_expired(persistence.work_seconds_ts, get_millis(), APP_CONFIG_WORK_SECONDS_CHECKPOINT_MS)) {
+        return 1;
+    }
+
+    unsigned long elapsed = time_interval(persistence.work_seconds_ts, get_millis());
+    *delay                = pdMS_TO_TICKS(APP_CONFIG_WORK_SECONDS_CHECKPOINT_MS - elapsed) + 1;
+    return 0;
+}
+
+
+/*
+ *  Runs every migration step between the stored version and the current one; returns the version reached
+ *  (0 if it could not be read)
+ */
+static uint8_t migrate(model_t *pmodel) {
+    uint8_t version = 0;
+
+    int res = load_uint8_option(&version, COMPATIBILITY_KEY);
+    if (res < 0) {
+        return 0;
+    } else if (res > 0) {
+        // Nothing stored yet
+        version = COMPATIBILITY_VERSION;
+    } else if (version == 0) {
+        // Version 1 is the oldest layout ever released
+        version = 1;
+    } else if (version > COMPATIBILITY_VERSION) {
+        ESP_LOGW(TAG, "Stored configuration version %i is newer than %i, leaving it untouched", version,
+                 (int)COMPATIBILITY_VERSION);
+        return version;
+    }
+
+    while (version < COMPATIBILITY_VERSION) {
+        ESP_LOGI(TAG, "Migrating configuration from version %i to %i", version, version + 1);
+        if (migrations[version - 1](pmodel)) {
+            // Keep the old version, the step is tried again at the next boot
+            ESP_LOGE(TAG, "Migration from version %i failed", version);
+            break;
+        }
+        version++;
+    }
+
+    save_uint8_option(&version, COMPATIBILITY_KEY);
+    storage_commit();
+    return version;
+}
+
+
+/*
+ *  Version 1 to 2: per-key layout to the single configuration record
+ */
+static int migrate_keys_to_record(model_t *pmodel) {
+    load_legacy_keys(pmodel);
+    return save_record(pmodel);
+}
+
+
+/*
+ *  Returns 0 if a valid record was found and applied to the model, -1 otherwise
+ */
+static int load_record(model_t *pmodel) {
+    configuration_record_t record = {0};
+
+    if (load_blob_option(&record, sizeof(record), CONFIGURATION_RECORD_KEY) != 0) {
+        return -1;
+    }
+    // A missing key leaves the record zeroed, which fails the version check
+    if (record.version != CONFIGURATION_RECORD_VERSION || record.crc != record_crc(&record)) {
+        return -1;
+    }
+
+    record.safety_message[EASYCONNECT_MESSAGE_SIZE]   = '\0';
+    record.feedback_message[EASYCONNECT_MESSAGE_SIZE] = '\0';
+
+    model_set_address(pmodel, record.address);
+    model_set_class(pmodel, record.class, NULL);
+    model_set_serial_number(pmodel, record.serial_number);
+    model_set_feedback_enabled(pmodel, record.feedback_enabled);
+    model_set_feedback_direction(pmodel, record.feedback_direction);
+    model_set_output_attempts(pmodel, record.output_attempts);
+    model_set_feedback_delay(pmodel, record.feedback_delay);
+    model_set_safety_message(pmodel, record.safety_message);
+    model_set_feedback_message(pmodel, record.feedback_message);
+    return 0;
+}
+
+
+/*
+ *  Per-key layout used by older firmware versions
+ */
+static void load_legacy_keys(model_t *pmodel) {
+    uint16_t value       = 0;
+    uint32_t value_32bit = 0;
+
+    if (load_uint16_option(&value, ADDRESS_KEY) == 0) {
+        model_set_address(pmodel, value);
+    }
+    if (load_uint32_option(&value_32bit, SERIAL_NUM_KEY) == 0) {
+        model_set_serial_number(pmodel, value_32bit);
+    }
+    if (load_uint16_option(&value, MODEL_KEY) == 0) {
+        model_set_class(pmodel, value, NULL);
+    }
+
+    load_blob_option(pmodel->safety_message, sizeof(pmodel->safety_message), SAFETY_MESSAGE_KEY);
+    load_blob_option(pmodel->feedback_message, sizeof(pmodel->feedback_message), FEEDBACK_MESSAGE_KEY);
+
+    uint8_t uint8_value = 0;
+    if (load_uint8_option(&uint8_value, FEEDBACK_ENABLE_KEY) == 0) {
+        model_set_feedback_enabled(pmodel, uint8_value);
+    }
+
+    if (load_uint8_option(&uint8_value, FEEDBACK_DIRECTION_KEY) == 0) {
+        model_set_feedback_direction(pmodel, uint8_value);
+    }
+    if (load_uint8_option(&uint8_value, ACTIVATION_ATTEMPTS_KEY) == 0) {
+        model_set_output_attempts(pmodel, uint8_value);
+    }
+    if (load_uint8_option(&uint8_value, FEEDBACK_DELAY_KEY) == 0) {
+        model_set_feedback_delay(pmodel, uint8_value);
+    }
+}
+
+
+static int save_record(model_t *pmodel) {
+    configuration_record_t record = {0};
+
+    record.version            = CONFIGURATION_RECORD_VERSION;
+    record.address            = model_get_address(pmodel);
+    record.class              = model_get_class(pmodel);
+    record.serial_number      = model_get_serial_number(pmodel);
+    record.feedback_enabled   = model_get_feedback_enabled(pmodel);
+    record.feedback_direction = model_get_feedback_direction(pmodel);
+    record.output_attempts    = model_get_output_attempts(pmodel);
+    record.feedback_delay     = model_get_feedback_delay(pmodel);
+    model_get_safety_message(pmodel, record.safety_message);
+    model_get_feedback_message(pmodel, record.feedback_message);
+    record.crc = record_crc(&record);
+
+    return save_blob_option(&record, sizeof(record), CONFIGURATION_RECORD_KEY);
+}
+
+
+static uint16_t record_crc(const configuration_record_t *record) {
+    return crc16_modbus((const uint8_t *)record, offsetof(configuration_record_t, crc));
 }
@@ -1,6 +1,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
+#include "esp_system.h"
 #include "controller.h"
 #include "gel/timer/timecheck.h"
 #include "utils/utils.h"
@@ -8,23 +9,32 @@
 #include "peripherals/digin.h"
 #include "peripherals/heartbeat.h"
 #include "peripherals/digout.h"
+#include "peripherals/retained.h"
 #include "model/model.h"
 #include "esp32c3_commandline.h"
 #include "config/app_config.h"
 #include "minion.h"
 #include "esp_console.h"
 #include "configuration.h"
+#include "bus_activity.h"
 #include "esp_log.h"
 #include "device_commands.h"
 #include "safety.h"
 #include "rele.h"
 #include "leds_communication.h"
 #include "leds_activity.h"
+#include "utils/event_loop.h"
 
 
 static void    console_task(void *args);
 static void    delay_ms(unsigned long ms);
 static uint8_t get_inputs(void *args);
+static void    update_status(model_t *pmodel);
+static void    update_retained(model_t *pmodel);
+static void    rele_observer(void *arg, uint32_t changes);
+static void    leds_observer(void *arg, uint32_t changes);
+static void    leds_tick(void *arg);
+static void    retained_tick(void *arg);
 
 
 static easyconnect_interface_t context = {
@@ -41,44 +51,62 @@ static easyconnect_interface_t context = {
 
 static const char *TAG = "Controller";
 
+// LED inputs coming from the model, updated only when they change
+static struct {
+    uint8_t communication_ok;
+    uint8_t attempts_ok;
+} leds = {0};
+
+static scheduler_timer_t leds_timer;
+static scheduler_timer_t retained_timer;
+
 
 void controller_init(model_t *pmodel) {
     (void)TAG;
     context.arg = pmodel;
+    model_set_boot_id(pmodel, (uint16_t)esp_random());
 
+    bus_activity_init();
     configuration_init(pmodel);
+    rele_init(pmodel);
     minion_init(&context);
 
+    model_subscribe(pmodel,
+                    MODEL_CHANGED(MODEL_FIELD_CLASS) | MODEL_CHANGED(MODEL_FIELD_MISSING_HEARTBEAT) |
+                        MODEL_CHANGED(MODEL_FIELD_SAFETY_BYPASS),
+                    rele_observer, pmodel);
+    model_subscribe(pmodel,
+                    MODEL_CHANGED(MODEL_FIELD_MISSING_HEARTBEAT) |
+                        MODEL_CHANGED(MODEL_FIELD_OUTPUT_ATTEMPTS_EXCEEDED),
+                    leds_observer, pmodel);
+    leds_observer(pmodel, 0);
+
+    scheduler_timer_init(&leds_timer, leds_tick, pmodel);
+    event_loop_arm(&leds_timer, 0);
+    scheduler_timer_init(&retained_timer, retained_tick, pmodel);
+    event_loop_arm(&retained_timer, APP_CONFIG_RETAINED_PERIOD_MS);
+
     static uint8_t      stack_buffer[APP_CONFIG_BASE_TASK_STACK_SIZE * 6];
     static StaticTask_t task_buffer;
     xTaskCreateStatic(console_task, "Console", sizeof(stack_buffer), &context, 1, stack_buffer, &task_buffer);
 }
 
 
+/*
+ *  One turn of the main loop: blocks until an event or a timer deadline, timers included in the wait run first
+ */
 void controller_manage(model_t *pmodel) {
-    static unsigned long save_ts = 0;
-
-    minion_manage();
-    rele_manage(pmodel);
+    uint32_t events = event_loop_wait();
 
-    if (digin_is_value_ready()) {
+    if (events & EVENT_LOOP_INPUT) {
         rele_refresh(pmodel);
     }
 
-    heartbeat_update_green(leds_communication_manage(get_millis(), !model_get_missing_heartbeat(pmodel)));
-    heartbeat_update_red(
-        leds_activity_manage(get_millis(), rele_is_on(), !model_get_output_attempts_exceeded(pmodel), safety_ok()));
-
-    if (model_get_work_time_to_save(pmodel)) {
-        if (is_expired(save_ts, get_millis(), 60UL * 1000UL)) {
-            configuration_save_work_seconds(model_get_work_seconds(pmodel));
-            model_set_work_time_to_save(pmodel, 0);
-            ESP_LOGI(TAG, "Saving %i seconds", model_get_work_seconds(pmodel));
-            save_ts = get_millis();
-        }
-    } else {
-        save_ts = 0;
-    }
+    // Persistence, relay and LED updates that depend on model fields run only when those fields changed
+    model_notify(pmodel);
+
+    update_status(pmodel);
+    update_retained(pmodel);
 }
 
 
@@ -92,6 +120,8 @@ static void console_task(void *args) {
 
     for (;;) {
         esp32c3_edit_cycle(prompt);
+        // Commands may have changed the model
+        event_loop_post(EVENT_LOOP_CONSOLE);
     }
 
     vTaskDelete(NULL);
@@ -107,3 +137,80 @@ static uint8_t get_inputs(void *args) {
     (void)args;
     return (uint8_t)digin_get_inputs();
 }
+
+
+/*
+ *  Mirrors the device status into the model, where changes are tracked for the master
+ */
+static void update_status(model_t *pmodel) {
+    model_t snapshot;
+    model_get_snapshot(pmodel, &snapshot);
+
+    uint16_t alarms = 0;
+    if (!safety_ok()) {
+        alarms |= MODEL_ALARM_SAFETY;
+    }
+    if (snapshot.output_attempts_exceeded) {
+        alarms |= MODEL_ALARM_ATTEMPTS_EXCEEDED;
+    }
+
+    model_update_status(pmodel, MODEL_STATUS_RELE_STATE, rele_get_channels_on());
+    model_update_status(pmodel, MODEL_STATUS_ALARMS, alarms);
+    model_update_status(pmodel, MODEL_STATUS_INPUTS, digin_get_inputs());
+    model_update_status(pmodel, MODEL_STATUS_OUTPUTS, (digout_get() != 0) | (snapshot.safety_bypass > 0) << 1);
+    model_update_status(pmodel, MODEL_STATUS_HEARTBEAT, snapshot.missing_heartbeat);
+    model_update_status(pmodel, MODEL_STATUS_ATTEMPTS, rele_get_attempts());
+    model_update_status(pmodel, MODEL_STATUS_WORK_SECONDS, snapshot.work_seconds);
+}
+
+
+/*
+ *  Keeps the live counters in RTC memory, including the seconds of an activation still in progress
+ */
+static void update_retained(model_t *pmodel) {
+    static retained_counters_t last = {0};
+
+    retained_counters_t counters = {
+        .work_seconds             = model_get_work_seconds(pmodel) + rele_get_running_seconds(),
+        .output_attempts_exceeded = model_get_output_attempts_exceeded(pmodel),
+    };
+
+    if (counters.work_seconds != last.work_seconds ||
+        counters.output_attempts_exceeded != last.output_attempts_exceeded) {
+        retained_store(&counters);
+        last = counters;
+    }
+}
+
+
+/*
+ *  The relay state depends on the device class, the heartbeat and the safety bypass
+ */
+static void rele_observer(void *arg, uint32_t changes) {
+    (void)changes;
+    rele_refresh(arg);
+}
+
+
+static void leds_observer(void *arg, uint32_t changes) {
+    (void)changes;
+    leds.communication_ok = !model_get_missing_heartbeat(arg);
+    leds.attempts_ok      = !model_get_output_attempts_exceeded(arg);
+}
+
+
+static void leds_tick(void *arg) {
+    (void)arg;
+    heartbeat_update_green(leds_communication_manage(get_millis(), leds.communication_ok));
+    heartbeat_update_red(leds_activity_manage(get_millis(), rele_is_on(), leds.attempts_ok, safety_ok()));
+    event_loop_arm(&leds_timer, APP_CONFIG_LEDS_PERIOD_MS);
+}
+
+
+/*
+ *  The seconds of an activation in progress grow without any event
+ */
+static void retained_tick(void *arg) {
+    update_retained(arg);
+    event_loop_arm(&retained_timer, APP_CONFIG_RETAINED_PERIOD_MS);
+}
@@ -1,8 +1,11 @@
 #include "esp_err.h"
 #include "esp_console.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "linenoise/linenoise.h"
 #include "argtable3/argtable3.h"
 #include "device_commands.h"
@@ -11,6 +14,8 @@
 #include "model/model.h"
 #include "configuration.h"
 #include "rele.h"
+#include "minion.h"
+#include "utils/crc16.h"
 
 
 static int device_commands_set_rele(int argc, char **argv);
@@ -22,6 +27,9 @@ static int device_commands_read_safety_message(int argc, char **argv);
 static int device_commands_set_safety_message(int argc, char **argv);
 static int device_commands_read_feedback_message(int argc, char **argv);
 static int device_commands_set_feedback_message(int argc, char **argv);
+static int device_commands_read_heap(int argc, char **argv);
+static int device_commands_bench_crc(int argc, char **argv);
+static int device_commands_bench_model(int argc, char **argv);
 
 
 static model_t *model_ref = NULL;
@@ -93,6 +101,30 @@ void device_commands_register(model_t *pmodel) {
         .func    = &device_commands_set_feedback_message,
     };
     ESP_ERROR_CHECK(esp_console_cmd_register(&set_feedback_message));
+
+    const esp_console_cmd_t read_heap = {
+        .command = "ReadHeap",
+        .help    = "Print the current and minimum ever free heap size and the heap lost by the Modbus requests",
+        .hint    = NULL,
+        .func    = &device_commands_read_heap,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&read_heap));
+
+    const esp_console_cmd_t bench_crc = {
+        .command = "BenchCRC",
+        .help    = "Compare the Modbus CRC implementations on 8 to 256 byte frames",
+        .hint    = NULL,
+        .func    = &device_commands_bench_crc,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&bench_crc));
+
+    const esp_console_cmd_t bench_model = {
+        .command = "BenchModel",
+        .help    = "Compare mutex and lock-free reads of the model",
+        .hint    = NULL,
+        .func    = &device_commands_bench_model,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&bench_model));
 }
 
 
@@ -299,3 +331,130 @@ static int device_commands_set_feedback_message(int argc, char **argv) {
     arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
     return nerrors ? -1 : 0;
 }
+
+
+static int device_commands_read_heap(int argc, char **argv) {
+    struct arg_end *end;
+    void           *argtable[] = {
+        end = arg_end(1),
+    };
+
+    int nerrors = arg_parse(argc, argv, argtable);
+    if (nerrors == 0) {
+        printf("Free heap=%u, Minimum free heap=%u, Lost by requests=%u\n", (unsigned int)esp_get_free_heap_size(),
+               (unsigned int)esp_get_minimum_free_heap_size(), (unsigned int)minion_get_heap_lost());
+    } else {
+        arg_print_errors(stdout, end, "Read heap usage");
+    }
+
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+    return nerrors ? -1 : 0;
+}
+
+
+static int device_commands_bench_crc(int argc, char **argv) {
+    struct arg_int *rep;
+    struct arg_end *end;
+    void           *argtable[] = {
+        rep = arg_int0(NULL, NULL, "<repetitions>", "Frames computed for every size (default 1000)"),
+        end = arg_end(1),
+    };
+
+    int nerrors = arg_parse(argc, argv, argtable);
+    if (nerrors == 0) {
+        const struct {
+            const char *name;
+            uint16_t (*crc)(const uint8_t *, size_t);
+        } implementations[] = {
+            {"bitwise", crc16_modbus_bitwise},
+            {"table", crc16_modbus_table},
+            {"slice-by-4", crc16_modbus_slice_by_4},
+        };
+        int repetitions = rep->count > 0 && rep->ival[0] > 0 ? rep->ival[0] : 1000;
+
+        static uint8_t frame[256] = {0};
+        for (size_t i = 0; i < sizeof(frame); i++) {
+            frame[i] = (uint8_t)rand();
+        }
+
+        printf("%-12s %8s %8s %8s %8s %8s %8s   (ns per frame)\n", "", "8", "16", "32", "64", "128", "256");
+        for (size_t i = 0; i < sizeof(implementations) / sizeof(implementations[0]); i++) {
+            printf("%-12s", implementations[i].name);
+            for (size_t size = 8; size <= sizeof(frame); size *= 2) {
+                volatile uint16_t sink  = 0;
+                int64_t           start = esp_timer_get_time();
+                for (int j = 0; j < repetitions; j++) {
+                    sink ^= implementations[i].crc(frame, size);
+                }
+                int64_t elapsed = esp_timer_get_time() - start;
+                (void)sink;
+                printf(" %8lu", (unsigned long)((elapsed * 1000) / repetitions));
+            }
+            printf("\n");
+        }
+    } else {
+        arg_print_errors(stdout, end, "Benchmark CRC");
+    }
+
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+    return nerrors ? -1 : 0;
+}
+
+
+static int device_commands_bench_model(int argc, char **argv) {
+    struct arg_int *rep;
+    struct arg_end *end;
+    void           *argtable[] = {
+        rep = arg_int0(NULL, NULL, "<repetitions>", "Reads performed for every path (default 10000)"),
+        end = arg_end(1),
+    };
+
+    int nerrors = arg_parse(argc, argv, argtable);
+    if (nerrors == 0) {
+        int               repetitions = rep->count > 0 && rep->ival[0] > 0 ? rep->ival[0] : 10000;
+        volatile uint32_t sink        = 0;
+        static model_t    snapshot;
+        int64_t           start;
+
+        printf("%-20s %10s\n", "", "ns per read");
+
+        // Reference: what every getter used to do
+        start = esp_timer_get_time();
+        for (int i = 0; i < repetitions; i++) {
+            xSemaphoreTake(model_ref->sem, portMAX_DELAY);
+            sink ^= model_ref->work_seconds;
+            xSemaphoreGive(model_ref->sem);
+        }
+        printf("%-20s %10lu\n", "field, mutex",
+               (unsigned long)(((esp_timer_get_time() - start) * 1000) / repetitions));
+
+        start = esp_timer_get_time();
+        for (int i = 0; i < repetitions; i++) {
+            sink ^= model_get_work_seconds(model_ref);
+        }
+        printf("%-20s %10lu\n", "field, lock-free",
+               (unsigned long)(((esp_timer_get_time() - start) * 1000) / repetitions));
+
+        start = esp_timer_get_time();
+        for (int i = 0; i < repetitions; i++) {
+            xSemaphoreTake(model_ref->sem, portMAX_DELAY);
+            memcpy(&snapshot, model_ref, sizeof(snapshot));
+            xSemaphoreGive(model_ref->sem);
+        }
+        printf("%-20s %10lu\n", "snapshot, mutex",
+               (unsigned long)(((esp_timer_get_time() - start) * 1000) / repetitions));
+
+        start = esp_timer_get_time();
+        for (int i = 0; i < repetitions; i++) {
+            model_get_snapshot(model_ref, &snapshot);
+        }
+        printf("%-20s %10lu\n", "snapshot, lock-free",
+               (unsigned long)(((esp_timer_get_time() - start) * 1000) / repetitions));
+        (void)sink;
+    } else {
+        arg_print_errors(stdout, end, "Benchmark model");
+    }
+
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+    return nerrors ? -1 : 0;
+}
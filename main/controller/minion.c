@@ -5,7 +5,12 @@
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "utils/utils.h"
+#include "utils/crc16.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "freertos/projdefs.h"
 #include "peripherals/hardwareprofile.h"
 #include "lightmodbus/base.h"
@@ -14,33 +19,81 @@
 #include "lightmodbus/slave_func.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "configuration.h"
-#include "peripherals/digout.h"
-#include "peripherals/digin.h"
 #include "peripherals/rs485.h"
 #include "easyconnect.h"
 #include "model/model.h"
 #include "rele.h"
-#include "safety.h"
-#include "config/app_config.h"
 #include "gel/serializer/serializer.h"
 #include "gel/timer/timecheck.h"
-#include "event_log.h"
-#include "model/model.h"
-
-
-#define HOLDING_REGISTER_SAFETY_MESSAGE   EASYCONNECT_HOLDING_REGISTER_MESSAGE_1
-#define HOLDING_REGISTER_FEEDBACK_MESSAGE (HOLDING_REGISTER_SAFETY_MESSAGE + EASYCONNECT_MESSAGE_NUM_REGISTERS)
-
-#define HOLDING_REGISTER_WORK_HOURS EASYCONNECT_HOLDING_REGISTER_CUSTOM_START
-
-#define COIL_RELE_STATE    0
-#define COIL_SAFETY_BYPASS 1
-
-static const char   *TAG = "Minion";
-static ModbusSlave   minion;
-static unsigned long timestamp = 0;
+#include "minion_registers.h"
+#include "bus_activity.h"
+#include "utils/event_loop.h"
+
+
+#define MAX_FRAME_SIZE    256
+#define MIN_FRAME_SIZE    4
+#define MAX_RESPONSE_SIZE (MAX_FRAME_SIZE - 3)     // PDU only, address and CRC are added by send_response
+#define BROADCAST_ADDRESS 0
+
+#define DIAGNOSTICS_RETURN_QUERY_DATA             0x00
+#define DIAGNOSTICS_CLEAR_COUNTERS                0x0A
+#define DIAGNOSTICS_BUS_MESSAGE_COUNT             0x0B
+#define DIAGNOSTICS_BUS_COMMUNICATION_ERROR_COUNT 0x0C
+#define DIAGNOSTICS_BUS_EXCEPTION_ERROR_COUNT     0x0D
+#define DIAGNOSTICS_SLAVE_MESSAGE_COUNT           0x0E
+#define DIAGNOSTICS_SLAVE_NO_RESPONSE_COUNT       0x0F
+#define DIAGNOSTICS_BUS_CHARACTER_OVERRUN_COUNT   0x12
+
+// Custom function codes from the user defined range
+#define FUNCTION_CODE_SET_BAUDRATE   100
+#define FUNCTION_CODE_STATUS_CHANGES 101
+
+static const char            *TAG = "Minion";
+static ModbusSlave            minion;
+static scheduler_timer_t      heartbeat_timer;
+// Orders a heartbeat against the expiration of the previous timeout, see heartbeat_expired
+static SemaphoreHandle_t heartbeat_sem = NULL;
+
+/*
+ *  Counters reported through the FC08 diagnostics function
+ */
+static struct {
+    uint16_t bus_messages;
+    uint16_t bus_communication_errors;
+    uint16_t exceptions;
+    uint16_t slave_messages;
+    uint16_t slave_no_responses;
+    uint16_t character_overruns;
+    // Free heap lost across the handling of a frame, in bytes (saturated); stays 0 as long as the request path
+    // does not allocate
+    uint16_t heap_lost;
+} diagnostics = {0};
+
+static struct {
+    // Baud rate to switch to once the current response has been sent, 0 if none
+    uint32_t pending;
+    // Running at a negotiated baud rate not yet confirmed by a valid frame
+    uint8_t confirming;
+    int64_t deadline_us;
+} baudrate_switch = {0};
+
+static const uint32_t supported_baudrates[] = {
+    EASYCONNECT_BAUDRATE, 9600, 19200, 38400, 57600, 230400, 460800, 921600,
+};
 
+static void                  minion_task(void *args);
+static void                  heartbeat_expired(void *arg);
+static ModbusError           response_allocator(ModbusBuffer *buffer, uint16_t size, void *context);
+static void                  handle_buffer(easyconnect_interface_t *context, uint8_t *buffer, size_t len);
+static void                  handle_frame(easyconnect_interface_t *context, uint8_t address, uint8_t *buffer,
+                                          size_t len);
+static void                  send_response(uint8_t address, const uint8_t *pdu, size_t len);
+static size_t                first_frame_length(const uint8_t *buffer, size_t len, uint8_t *crc_ok);
+static size_t                foreign_frame_length(const uint8_t *buffer, size_t len, uint8_t address);
+static uint8_t               frame_crc_ok(const uint8_t *buffer, size_t len);
+static uint32_t              frame_silence_us(uint32_t baud_rate);
 static ModbusError           register_callback(const ModbusSlave *status, const ModbusRegisterCallbackArgs *args,
                                                ModbusRegisterCallbackResult *result);
 static ModbusError           exception_callback(const ModbusSlave *minion, uint8_t function, ModbusExceptionCode code);
@@ -52,6 +105,19 @@ static LIGHTMODBUS_RET_ERROR set_datetime(ModbusSlave *minion, uint8_t function,
                                           uint8_t requestLength);
 static LIGHTMODBUS_RET_ERROR heartbeat_received(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
                                                 uint8_t requestLength);
+static LIGHTMODBUS_RET_ERROR set_baudrate(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
+                                          uint8_t requestLength);
+static LIGHTMODBUS_RET_ERROR diagnostics_function(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
+                                                  uint8_t requestLength);
+static LIGHTMODBUS_RET_ERROR status_changes(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
+                                            uint8_t requestLength);
+static void                  apply_pending_baudrate(void);
+static void                  check_baudrate_fallback(void);
+static uint8_t               valid_baudrate(uint32_t baud_rate);
+#if APP_CONFIG_AUTOBAUD
+static void                  autobaud(void);
+static uint8_t               autobaud_listen(unsigned long window_ms);
+#endif
 
 
 static const ModbusSlaveFunctionHandler custom_functions[] = {
@@ -73,6 +139,7 @@ static const ModbusSlaveFunctionHandler custom_functions[] = {
 #if defined(LIGHTMODBUS_F06S) || defined(LIGHTMODBUS_SLAVE_FULL)
     {6, modbusParseRequest0506},
 #endif
+    {8, diagnostics_function},
 #if defined(LIGHTMODBUS_F15S) || defined(LIGHTMODBUS_SLAVE_FULL)
     {15, modbusParseRequest1516},
 #endif
@@ -89,20 +156,32 @@ static const ModbusSlaveFunctionHandler custom_functions[] = {
     {EASYCONNECT_FUNCTION_CODE_HEARTBEAT, heartbeat_received},
     {EASYCONNECT_FUNCTION_CODE_NETWORK_INITIALIZATION, initialization_function},
     {EASYCONNECT_FUNCTION_CODE_SET_CLASS_OUTPUT, set_class_output},
+    {FUNCTION_CODE_SET_BAUDRATE, set_baudrate},
+    {FUNCTION_CODE_STATUS_CHANGES, status_changes},
 
     // Guard - prevents 0 array size
     {0, NULL},
 };
 
+#define NUM_CUSTOM_FUNCTIONS (sizeof(custom_functions) / sizeof(custom_functions[0]) - 1)
+
+
+/*
+ *  Bytes of heap not given back by the request path since boot or the last FC08 clear counters
+ */
+uint16_t minion_get_heap_lost(void) {
+    return diagnostics.heap_lost;
+}
+
 
 void minion_init(easyconnect_interface_t *context) {
     ModbusErrorInfo err;
     err = modbusSlaveInit(&minion,
                           register_callback,          // Callback for register operations
                           exception_callback,         // Callback for handling minion exceptions (optional)
-                          modbusDefaultAllocator,     // Memory allocator for allocating responses
+                          response_allocator,         // Memory allocator for allocating responses
                           custom_functions,           // Set of supported functions
-                          15                          // Number of supported functions
+                          NUM_CUSTOM_FUNCTIONS        // Number of supported functions
     );
 
     // Check for errors
@@ -110,246 +189,461 @@ void minion_init(easyconnect_interface_t *context) {
 
     modbusSlaveSetUserPointer(&minion, context);
 
-    timestamp = get_millis();
+    static StaticSemaphore_t heartbeat_semaphore_buffer;
+    heartbeat_sem = xSemaphoreCreateMutexStatic(&heartbeat_semaphore_buffer);
+
+    // Re-armed by every heartbeat, expires only if the master goes silent
+    scheduler_timer_init(&heartbeat_timer, heartbeat_expired, context);
+    event_loop_arm(&heartbeat_timer, EASYCONNECT_HEARTBEAT_TIMEOUT);
+
+    static uint8_t      stack_buffer[APP_CONFIG_BASE_TASK_STACK_SIZE * 8];
+    static StaticTask_t task_buffer;
+    xTaskCreateStatic(minion_task, "Minion", sizeof(stack_buffer), context, APP_CONFIG_MINION_TASK_PRIORITY,
+                      stack_buffer, &task_buffer);
+}
+
+
+/*
+ *  Runs in the main loop when no heartbeat arrived for EASYCONNECT_HEARTBEAT_TIMEOUT.
+ *  A heartbeat received between the expiration and this callback has armed the timer again and must win.
+ */
+static void heartbeat_expired(void *arg) {
+    easyconnect_interface_t *context = arg;
+
+    xSemaphoreTake(heartbeat_sem, portMAX_DELAY);
+    if (!event_loop_is_armed(&heartbeat_timer)) {
+        model_set_missing_heartbeat(context->arg, 1);
+    }
+    xSemaphoreGive(heartbeat_sem);
 }
 
 
-void minion_manage(void) {
-    uint8_t buffer[256] = {0};
-    int     len         = rs485_read(buffer, 256);
+/*
+ *  Receives frames from the bus and answers them as soon as the line goes idle.
+ *  The UART driver signals the end of a frame with an RX timeout event, so the task sleeps
+ *  until there is something to parse instead of polling the buffer.
+ *  Every chunk is timestamped: a silence of at least t3.5 before a chunk also closes the pending
+ *  frame, which covers the case of a frame ending exactly on a FIFO-full event (no timeout follows).
+ */
+static void minion_task(void *args) {
+    easyconnect_interface_t *context                = args;
+    uint8_t                  buffer[MAX_FRAME_SIZE] = {0};
+    size_t                   len                    = 0;
+    int64_t                  last_rx_us             = 0;
+
+#if APP_CONFIG_AUTOBAUD
+    autobaud();
+#endif
+
+    for (;;) {
+        uint32_t      t35_us  = frame_silence_us(rs485_get_baudrate());
+        unsigned long timeout = RS485_WAIT_FOREVER;
+
+        if (len > 0) {
+            // With a partial frame pending wake up after t3.5 at the latest to close it
+            timeout = t35_us / 1000 + 2;
+        } else if (baudrate_switch.confirming) {
+            // A deadline already gone by must not turn into a huge unsigned timeout
+            int64_t remaining_us = baudrate_switch.deadline_us - esp_timer_get_time();
+            timeout              = remaining_us > 0 ? (unsigned long)(remaining_us / 1000) + 1 : 0;
+        }
 
-    easyconnect_interface_t *context = modbusSlaveGetUserPointer(&minion);
+        rs485_event_t event = {0};
+        int           res   = rs485_wait_event(&event, timeout);
+        check_baudrate_fallback();
 
-    if (len > 0) {
-        /*
-        printf("Read %i bytes\n", len);
-        for (uint16_t i = 0; i < len;i++){ 
-            printf("0x%X ", buffer[i]);
+        if (res) {
+            if (len > 0 && esp_timer_get_time() - last_rx_us >= t35_us) {
+                handle_buffer(context, buffer, len);
+                len = 0;
+            }
+            continue;
         }
-        printf("\n");
-        */
-        //ESP_LOG_BUFFER_HEX(TAG, buffer, len);
-
-        ModbusErrorInfo err;
-        err = modbusParseRequestRTU(&minion, context->get_address(context->arg), buffer, len);
-
-        if (modbusIsOk(err)) {
-            size_t rlen = modbusSlaveGetResponseLength(&minion);
-            if (rlen > 0) {
-                //printf("responding with %i bytes\n", rlen);
-                rs485_write((uint8_t *)modbusSlaveGetResponse(&minion), rlen);
+
+        switch (event.code) {
+            case RS485_EVENT_DATA: {
+                int64_t now = esp_timer_get_time();
+                if (len > 0 && now - last_rx_us >= t35_us) {
+                    handle_buffer(context, buffer, len);
+                    len = 0;
+                }
+
+                if (event.len > sizeof(buffer) - len) {
+                    // Longer than any valid frame, drop what we have so far
+                    ESP_LOGW(TAG, "Frame too long, discarding");
+                    len = 0;
+                }
+
+                int read = rs485_read_available(&buffer[len], sizeof(buffer) - len);
+                if (read > 0) {
+                    len += read;
+                    last_rx_us = now;
+                    bus_activity_received();
+                }
+
+                if (event.frame_end && len > 0) {
+                    handle_buffer(context, buffer, len);
+                    len = 0;
+                }
+                break;
+            }
+
+            case RS485_EVENT_OVERRUN:
+                diagnostics.character_overruns++;
+                len = 0;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    vTaskDelete(NULL);
+}
+
+
+/*
+ *  A buffer delimited by bus silence normally holds exactly one frame, but a master pipelining requests
+ *  (or a reply from another node immediately followed by the next request) can glue several together.
+ *  If the CRC of the whole buffer does not match it is split at every prefix that closes with a valid CRC.
+ *  Most of the traffic is addressed to other nodes: those frames are recognized from the first byte and
+ *  skipped without computing any CRC.
+ */
+static void handle_buffer(easyconnect_interface_t *context, uint8_t *buffer, size_t len) {
+    uint8_t address = (uint8_t)context->get_address(context->arg);
+    size_t  start   = 0;
+
+    while (start < len) {
+        uint8_t *frame     = &buffer[start];
+        size_t   remaining = len - start;
+        size_t   frame_len = 0;
+
+        diagnostics.bus_messages++;
+
+        if (frame[0] != address && frame[0] != BROADCAST_ADDRESS) {
+            frame_len = foreign_frame_length(frame, remaining, address);
+        } else {
+            uint8_t crc_ok = 0;
+            frame_len      = first_frame_length(frame, remaining, &crc_ok);
+
+            if (crc_ok) {
+                if (baudrate_switch.confirming) {
+                    // The master is talking to us at the new speed
+                    ESP_LOGI(TAG, "Baud rate %i confirmed", (int)rs485_get_baudrate());
+                    baudrate_switch.confirming = 0;
+                }
+                // Sampled around the request path only; the minion task has the highest application priority,
+                // so other allocations rarely fall in between
+                uint32_t free_heap = esp_get_free_heap_size();
+                handle_frame(context, address, frame, frame_len);
+                uint32_t free_heap_after = esp_get_free_heap_size();
+                if (free_heap_after < free_heap) {
+                    uint32_t lost         = diagnostics.heap_lost + (free_heap - free_heap_after);
+                    diagnostics.heap_lost = lost > UINT16_MAX ? UINT16_MAX : (uint16_t)lost;
+                }
             } else {
-                ESP_LOGD(TAG, "Empty response");
+                diagnostics.bus_communication_errors++;
+                ESP_LOGW(TAG, "Invalid CRC");
+                ESP_LOG_BUFFER_HEX(TAG, frame, frame_len);
             }
-        } else if (err.error != MODBUS_ERROR_ADDRESS) {
-            ESP_LOGW(TAG, "Invalid request with source %i and error %i", err.source, err.error);
-            ESP_LOG_BUFFER_HEX(TAG, buffer, len);
+        }
+
+        start += frame_len;
+    }
+
+    apply_pending_baudrate();
+}
+
+
+/*
+ *  Guesses where a frame for another node ends from its function code alone (as a request or as a response),
+ *  to find out whether a frame for us is glued after it. Without a match the rest of the buffer is skipped.
+ */
+static size_t foreign_frame_length(const uint8_t *buffer, size_t len, uint8_t address) {
+    size_t candidates[2] = {0};
+
+    if (len < MIN_FRAME_SIZE) {
+        return len;
+    }
+
+    uint8_t function = buffer[1];
+    if (function & 0x80) {
+        // Exception response
+        candidates[0] = 5;
+    } else {
+        switch (function) {
+            case 1:
+            case 2:
+            case 3:
+            case 4:
+                candidates[0] = 8;                 // Request
+                candidates[1] = 5 + buffer[2];     // Response
+                break;
+
+            case 5:
+            case 6:
+                candidates[0] = 8;
+                break;
+
+            case 15:
+            case 16:
+                candidates[0] = 8;     // Response
+                if (len > 6) {
+                    candidates[1] = 9 + buffer[6];     // Request
+                }
+                break;
+
+            case 22:
+                candidates[0] = 10;
+                break;
+
+            default:
+                break;
         }
     }
 
-    if (is_expired(timestamp, get_millis(), EASYCONNECT_HEARTBEAT_TIMEOUT)) {
-        if (model_get_missing_heartbeat(context->arg) == 0) {
-            model_set_missing_heartbeat(context->arg, 1);
-            rele_refresh(context->arg);
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        if (candidates[i] > 0 && candidates[i] < len && buffer[candidates[i]] == address) {
+            return candidates[i];
         }
     }
+
+    return len;
 }
 
 
-ModbusError register_callback(const ModbusSlave *status, const ModbusRegisterCallbackArgs *args,
-                              ModbusRegisterCallbackResult *result) {
+static size_t first_frame_length(const uint8_t *buffer, size_t len, uint8_t *crc_ok) {
+    *crc_ok = 0;
 
-    easyconnect_interface_t *ctx = modbusSlaveGetUserPointer(status);
-    result->value                = 0;
+    if (len < MIN_FRAME_SIZE) {
+        return len;
+    } else if (frame_crc_ok(buffer, len)) {
+        *crc_ok = 1;
+        return len;
+    }
 
-    switch (args->query) {
-        // R/W access check
-        case MODBUS_REGQ_R_CHECK:
-            result->exceptionCode = MODBUS_EXCEP_NONE;
-            break;
+    // Running CRC over the prefix; a prefix of i bytes is a frame if the next two bytes are its CRC
+    uint16_t crc = CRC16_MODBUS_INIT;
+    for (size_t i = 0; i + 2 < len; i++) {
+        if (i >= MIN_FRAME_SIZE - 2 && crc == (buffer[i] | (buffer[i + 1] << 8))) {
+            *crc_ok = 1;
+            return i + 2;
+        }
+        crc = crc16_modbus_update(crc, buffer[i]);
+    }
 
-        case MODBUS_REGQ_W_CHECK:
-            result->exceptionCode = MODBUS_EXCEP_NONE;
-
-            switch (args->type) {
-                case MODBUS_HOLDING_REGISTER: {
-                    switch (args->index) {
-                        case EASYCONNECT_HOLDING_REGISTER_ADDRESS:
-                        case EASYCONNECT_HOLDING_REGISTER_CLASS:
-                        case EASYCONNECT_HOLDING_REGISTER_SERIAL_NUMBER_1:
-                        case EASYCONNECT_HOLDING_REGISTER_SERIAL_NUMBER_2:
-                        case HOLDING_REGISTER_WORK_HOURS:
-                            break;
-
-                        default:
-                            result->exceptionCode = MODBUS_EXCEP_ILLEGAL_FUNCTION;
-                            break;
-                    }
-                    break;
-                }
-                case MODBUS_INPUT_REGISTER:
-                    result->exceptionCode = MODBUS_EXCEP_ILLEGAL_FUNCTION;
-                    break;
-                case MODBUS_DISCRETE_INPUT:
-                    result->exceptionCode = MODBUS_EXCEP_ILLEGAL_FUNCTION;
-                    break;
-                default:
-                    break;
+    // No frame boundary found, report it as a whole
+    return len;
+}
+
+
+static uint8_t frame_crc_ok(const uint8_t *buffer, size_t len) {
+    return crc16_modbus(buffer, len - 2) == (buffer[len - 2] | (buffer[len - 1] << 8));
+}
+
+
+/*
+ *  A baud rate change is applied only once the response to the request that asked for it has left the UART,
+ *  and it is kept only if a valid frame for us arrives within APP_CONFIG_BAUDRATE_FALLBACK_MS
+ */
+static void apply_pending_baudrate(void) {
+    if (baudrate_switch.pending == 0) {
+        return;
+    }
+
+    rs485_wait_tx_done();
+    ESP_LOGI(TAG, "Switching to %i baud", (int)baudrate_switch.pending);
+    rs485_set_baudrate(baudrate_switch.pending);
+
+    baudrate_switch.confirming  = baudrate_switch.pending != EASYCONNECT_BAUDRATE;
+    baudrate_switch.deadline_us = esp_timer_get_time() + APP_CONFIG_BAUDRATE_FALLBACK_MS * 1000LL;
+    baudrate_switch.pending     = 0;
+}
+
+
+static void check_baudrate_fallback(void) {
+    if (baudrate_switch.confirming && esp_timer_get_time() >= baudrate_switch.deadline_us) {
+        ESP_LOGW(TAG, "No valid frame at %i baud, falling back to %i", (int)rs485_get_baudrate(),
+                 EASYCONNECT_BAUDRATE);
+        rs485_set_baudrate(EASYCONNECT_BAUDRATE);
+        rs485_flush();
+        baudrate_switch.confirming = 0;
+    }
+}
+
+
+static uint8_t valid_baudrate(uint32_t baud_rate) {
+    for (size_t i = 0; i < sizeof(supported_baudrates) / sizeof(supported_baudrates[0]); i++) {
+        if (supported_baudrates[i] == baud_rate) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+#if APP_CONFIG_AUTOBAUD
+/*
+ *  Listens on every supported baud rate in turn until a frame with a valid CRC (for any node) shows up,
+ *  then stays there. After APP_CONFIG_AUTOBAUD_ROUNDS unsuccessful rounds it settles on the default.
+ */
+static void autobaud(void) {
+    for (int round = 0; round < APP_CONFIG_AUTOBAUD_ROUNDS; round++) {
+        for (size_t i = 0; i < sizeof(supported_baudrates) / sizeof(supported_baudrates[0]); i++) {
+            rs485_set_baudrate(supported_baudrates[i]);
+            rs485_flush();
+
+            if (autobaud_listen(APP_CONFIG_AUTOBAUD_WINDOW_MS)) {
+                ESP_LOGI(TAG, "Autobaud: detected %i baud", (int)supported_baudrates[i]);
+                return;
             }
-            break;
+        }
+    }
 
-        // Read register
-        case MODBUS_REGQ_R:
-            switch (args->type) {
-                case MODBUS_HOLDING_REGISTER: {
-                    switch (args->index) {
-                        case EASYCONNECT_HOLDING_REGISTER_ADDRESS:
-                            result->value = ctx->get_address(ctx->arg);
-                            break;
-
-                        case EASYCONNECT_HOLDING_REGISTER_FIRMWARE_VERSION:
-                            result->value = EASYCONNECT_FIRMWARE_VERSION(APP_CONFIG_FIRMWARE_VERSION_MAJOR,
-                                                                         APP_CONFIG_FIRMWARE_VERSION_MINOR,
-                                                                         APP_CONFIG_FIRMWARE_VERSION_PATCH);
-                            break;
-
-                        case EASYCONNECT_HOLDING_REGISTER_CLASS:
-                            result->value = ctx->get_class(ctx->arg);
-                            break;
-
-                        case EASYCONNECT_HOLDING_REGISTER_SERIAL_NUMBER_1:
-                            result->value = (ctx->get_serial_number(ctx->arg) >> 16) & 0xFFFF;
-                            break;
-
-                        case EASYCONNECT_HOLDING_REGISTER_SERIAL_NUMBER_2:
-                            result->value = ctx->get_serial_number(ctx->arg) & 0xFFFF;
-                            break;
-
-                        case EASYCONNECT_HOLDING_REGISTER_ALARMS:
-                            if (!safety_ok()) {
-                                result->value |= 0x01;
-                            }
-                            if (model_get_output_attempts_exceeded(ctx->arg)) {
-                                result->value |= 0x02;
-                            }
-                            break;
-
-                        case EASYCONNECT_HOLDING_REGISTER_STATE:
-                            result->value = rele_is_on();
-                            break;
-
-                        case EASYCONNECT_HOLDING_REGISTER_LOGS_COUNTER:
-                            result->value = event_log_get_count();
-                            break;
-
-                        case EASYCONNECT_HOLDING_REGISTER_LOGS ... HOLDING_REGISTER_SAFETY_MESSAGE - 1: {
-                            size_t event_index =
-                                (args->index - EASYCONNECT_HOLDING_REGISTER_LOGS) / EVENT_LOG_SERIALIZED_SIZE;
-                            uint8_t buffer[EVENT_LOG_SERIALIZED_SIZE] = {0};
-                            event_log_serialize_event(buffer, event_index);
-
-                            size_t buffer_index = (args->index - EASYCONNECT_HOLDING_REGISTER_LOGS) % 8;
-                            result->value       = (buffer[buffer_index] << 8) | buffer[buffer_index + 1];
-
-                            break;
-                        }
-
-                        case HOLDING_REGISTER_SAFETY_MESSAGE ... HOLDING_REGISTER_FEEDBACK_MESSAGE - 1: {
-                            char msg[EASYCONNECT_MESSAGE_SIZE + 1] = {0};
-                            model_get_safety_message(ctx->arg, msg);
-                            size_t i      = args->index - HOLDING_REGISTER_SAFETY_MESSAGE;
-                            result->value = msg[i * 2] << 8 | msg[i * 2 + 1];
-                            break;
-                        }
-
-                        case HOLDING_REGISTER_FEEDBACK_MESSAGE ... HOLDING_REGISTER_FEEDBACK_MESSAGE +
-                            EASYCONNECT_MESSAGE_NUM_REGISTERS - 1: {
-                            char msg[EASYCONNECT_MESSAGE_SIZE + 1] = {0};
-                            model_get_feedback_message(ctx->arg, msg);
-                            size_t i      = args->index - HOLDING_REGISTER_SAFETY_MESSAGE;
-                            result->value = msg[i] << 8 | msg[i];
-                            break;
-                        }
-
-                        case HOLDING_REGISTER_WORK_HOURS:
-                            result->value = model_get_work_hours(ctx->arg);
-                            break;
-                    }
-                    break;
-                }
-                case MODBUS_INPUT_REGISTER:
-                    break;
-                case MODBUS_COIL:
-                    result->value = digout_get();
-                    break;
-                case MODBUS_DISCRETE_INPUT:
-                    result->value = digin_get(args->index);
-                    break;
+    ESP_LOGW(TAG, "Autobaud: no traffic detected, using %i baud", EASYCONNECT_BAUDRATE);
+    rs485_set_baudrate(EASYCONNECT_BAUDRATE);
+}
+
+
+static uint8_t autobaud_listen(unsigned long window_ms) {
+    uint8_t       buffer[MAX_FRAME_SIZE] = {0};
+    size_t        len                    = 0;
+    unsigned long start                  = get_millis();
+
+    for (;;) {
+        unsigned long elapsed = time_interval(start, get_millis());
+        if (elapsed >= window_ms) {
+            return 0;
+        }
+
+        rs485_event_t event = {0};
+        if (rs485_wait_event(&event, window_ms - elapsed)) {
+            continue;
+        }
+
+        if (event.code == RS485_EVENT_DATA) {
+            if (event.len > sizeof(buffer) - len) {
+                len = 0;
             }
-            break;
 
-        // Write register
-        case MODBUS_REGQ_W:
-            switch (args->type) {
-                case MODBUS_HOLDING_REGISTER: {
-                    switch (args->index) {
-                        case EASYCONNECT_HOLDING_REGISTER_ADDRESS:
-                            ctx->save_address(ctx->arg, args->value);
-                            break;
-                        case EASYCONNECT_HOLDING_REGISTER_CLASS:
-                            ctx->save_class(ctx->arg, args->value);
-                            break;
-                        case EASYCONNECT_HOLDING_REGISTER_SERIAL_NUMBER_1: {
-                            uint32_t current_serial_number = ctx->get_serial_number(ctx->arg);
-                            ctx->save_serial_number(ctx->arg, (args->value << 16) | (current_serial_number & 0xFFFF));
-                            break;
-                        }
-                        case EASYCONNECT_HOLDING_REGISTER_SERIAL_NUMBER_2: {
-                            uint32_t current_serial_number = ctx->get_serial_number(ctx->arg);
-                            ctx->save_serial_number(ctx->arg, args->value | (current_serial_number & 0xFFFF0000));
-                            break;
-                        }
-                        case HOLDING_REGISTER_WORK_HOURS:
-                            model_reset_work_seconds(ctx->arg);
-                            break;
-                    }
-                    break;
-                }
+            int read = rs485_read_available(&buffer[len], sizeof(buffer) - len);
+            if (read > 0) {
+                len += read;
+            }
 
-                case MODBUS_COIL:
-                    switch (args->index) {
-                        case COIL_RELE_STATE:
-                            // printf("state coil %i\n", args->value);
-                            if (rele_update(ctx->arg, args->value)) {
-                                result->exceptionCode = MODBUS_EXCEP_SLAVE_FAILURE;
-                            }
-                            break;
-
-                        case COIL_SAFETY_BYPASS:
-                            model_set_safety_bypass(ctx->arg, args->value);
-                            // printf("coil %i\n", model_get_safety_bypass(ctx->arg));
-                            break;
-
-                        default:
-                            break;
-                    }
-                    break;
-
-                case MODBUS_INPUT_REGISTER:
-                    break;
-
-                default:
-                    break;
+            if (event.frame_end) {
+                uint8_t crc_ok = 0;
+                first_frame_length(buffer, len, &crc_ok);
+                if (crc_ok) {
+                    return 1;
+                }
+                len = 0;
             }
-            break;
+        } else {
+            len = 0;
+        }
     }
+}
+#endif
 
-    // Always return MODBUS_OK
-    return MODBUS_OK;
+
+/*
+ *  Minimum silence between two RTU frames: 3.5 characters of 11 bits, fixed at 1750us above 19200 baud
+ */
+static uint32_t frame_silence_us(uint32_t baud_rate) {
+    if (baud_rate > 19200 || baud_rate == 0) {
+        return 1750;
+    } else {
+        return (35UL * 11UL * 100000UL) / baud_rate;
+    }
+}
+
+
+/*
+ *  The frame has already been checked for address and CRC: only the PDU goes to the parser
+ *  and the RTU response is packed here, so liblightmodbus never computes a CRC of its own.
+ */
+static void handle_frame(easyconnect_interface_t *context, uint8_t address, uint8_t *buffer, size_t len) {
+    ModbusErrorInfo err;
+    diagnostics.slave_messages++;
+    minion_registers_begin_request();
+    err = modbusParseRequestPDU(&minion, &buffer[1], len - 3);
+
+    if (modbusIsOk(err)) {
+        // Apply the writes staged by the request before answering, so that the next request already sees them
+        minion_registers_end_request(context);
+        // Whatever the request changed is handled by the main loop
+        event_loop_post(EVENT_LOOP_MODBUS);
+
+        size_t rlen = modbusSlaveGetResponseLength(&minion);
+        if (buffer[0] == BROADCAST_ADDRESS) {
+            // Broadcast requests are never answered
+            diagnostics.slave_no_responses++;
+        } else if (rlen > 0) {
+            send_response(address, modbusSlaveGetResponse(&minion), rlen);
+            rs485_wait_tx_done();
+            bus_activity_response_sent();
+        } else {
+            diagnostics.slave_no_responses++;
+            ESP_LOGD(TAG, "Empty response");
+        }
+    } else {
+        diagnostics.slave_no_responses++;
+        ESP_LOGW(TAG, "Invalid request with source %i and error %i", err.source, err.error);
+        ESP_LOG_BUFFER_HEX(TAG, buffer, len);
+    }
+}
+
+
+static void send_response(uint8_t address, const uint8_t *pdu, size_t len) {
+    static uint8_t frame[MAX_FRAME_SIZE] = {0};
+
+    if (len > sizeof(frame) - 3) {
+        ESP_LOGW(TAG, "Response too long (%zu bytes)", len);
+        return;
+    }
+
+    frame[0] = address;
+    memcpy(&frame[1], pdu, len);
+    uint16_t crc   = crc16_modbus(frame, len + 1);
+    frame[len + 1] = crc & 0xFF;
+    frame[len + 2] = (crc >> 8) & 0xFF;
+
+    rs485_write(frame, len + 3);
+}
+
+
+/*
+ *  Only one response is alive at any time, so it always goes in the same static buffer
+ *  and answering a request never touches the heap.
+ */
+static ModbusError response_allocator(ModbusBuffer *buffer, uint16_t size, void *context) {
+    static uint8_t response[MAX_RESPONSE_SIZE];
+    (void)context;
+
+    if (size == 0) {
+        // Free
+        buffer->data = NULL;
+        return MODBUS_OK;
+    } else if (size <= sizeof(response)) {
+        buffer->data = response;
+        return MODBUS_OK;
+    } else {
+        ESP_LOGW(TAG, "Response too long (%i bytes)", size);
+        buffer->data = NULL;
+        return MODBUS_ERROR_ALLOC;
+    }
+}
+
+
+static ModbusError register_callback(const ModbusSlave *status, const ModbusRegisterCallbackArgs *args,
+                                     ModbusRegisterCallbackResult *result) {
+    return minion_registers_access(modbusSlaveGetUserPointer(status), args, result);
 }
 
 
 static ModbusError exception_callback(const ModbusSlave *minion, uint8_t function, ModbusExceptionCode code) {
+    diagnostics.exceptions++;
     ESP_LOGI(TAG, "Slave reports an exception %d (function %d)\n", code, function);
     // Always return MODBUS_OK
     return MODBUS_OK;
@@ -390,9 +684,167 @@ static LIGHTMODBUS_RET_ERROR heartbeat_received(ModbusSlave *minion, uint8_t fun
     easyconnect_interface_t *ctx = modbusSlaveGetUserPointer(minion);
     ESP_LOGD(TAG, "Heartbeat");
 
-    timestamp = get_millis();
+    xSemaphoreTake(heartbeat_sem, portMAX_DELAY);
+    event_loop_arm(&heartbeat_timer, EASYCONNECT_HEARTBEAT_TIMEOUT);
+    // The relay is refreshed by the model observer, only if the heartbeat was actually missing
     model_set_missing_heartbeat(ctx->arg, 0);
-    rele_refresh(ctx->arg);
+    xSemaphoreGive(heartbeat_sem);
+    return MODBUS_NO_ERROR();
+}
+
+
+/*
+ *  Standard Modbus diagnostics (FC08), serial line subfunctions backed by the receive path counters.
+ *  Request and response: function code, subfunction (16 bit), data (16 bit).
+ */
+static LIGHTMODBUS_RET_ERROR diagnostics_function(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
+                                                  uint8_t requestLength) {
+    // Check request length
+    if (requestLength < 5) {
+        return modbusBuildException(minion, function, MODBUS_EXCEP_ILLEGAL_VALUE);
+    }
+
+    uint16_t subfunction = (requestPDU[1] << 8) | requestPDU[2];
+    uint16_t data        = (requestPDU[3] << 8) | requestPDU[4];
+
+    switch (subfunction) {
+        case DIAGNOSTICS_RETURN_QUERY_DATA:
+            break;
+
+        case DIAGNOSTICS_CLEAR_COUNTERS:
+            memset(&diagnostics, 0, sizeof(diagnostics));
+            break;
+
+        case DIAGNOSTICS_BUS_MESSAGE_COUNT:
+            data = diagnostics.bus_messages;
+            break;
+
+        case DIAGNOSTICS_BUS_COMMUNICATION_ERROR_COUNT:
+            data = diagnostics.bus_communication_errors;
+            break;
+
+        case DIAGNOSTICS_BUS_EXCEPTION_ERROR_COUNT:
+            data = diagnostics.exceptions;
+            break;
+
+        case DIAGNOSTICS_SLAVE_MESSAGE_COUNT:
+            data = diagnostics.slave_messages;
+            break;
+
+        case DIAGNOSTICS_SLAVE_NO_RESPONSE_COUNT:
+            data = diagnostics.slave_no_responses;
+            break;
+
+        case DIAGNOSTICS_BUS_CHARACTER_OVERRUN_COUNT:
+            data = diagnostics.character_overruns;
+            break;
+
+        default:
+            return modbusBuildException(minion, function, MODBUS_EXCEP_ILLEGAL_FUNCTION);
+    }
+
+    ModbusErrorInfo err = modbusSlaveAllocateResponse(minion, 5);
+    if (!modbusIsOk(err)) {
+        return err;
+    }
+
+    minion->response.pdu[0] = function;
+    minion->response.pdu[1] = (subfunction >> 8) & 0xFF;
+    minion->response.pdu[2] = subfunction & 0xFF;
+    minion->response.pdu[3] = (data >> 8) & 0xFF;
+    minion->response.pdu[4] = data & 0xFF;
+    return MODBUS_NO_ERROR();
+}
+
+
+/*
+ *  Request: function code, baud rate (32 bit big endian). The response echoes the request at the current speed.
+ */
+static LIGHTMODBUS_RET_ERROR set_baudrate(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
+                                          uint8_t requestLength) {
+    // Check request length
+    if (requestLength < 5) {
+        return modbusBuildException(minion, function, MODBUS_EXCEP_ILLEGAL_VALUE);
+    }
+
+    uint32_t baud_rate = 0;
+    deserialize_uint32_be(&baud_rate, (uint8_t *)&requestPDU[1]);
+
+    if (!valid_baudrate(baud_rate)) {
+        return modbusBuildException(minion, function, MODBUS_EXCEP_ILLEGAL_VALUE);
+    }
+
+    ModbusErrorInfo err = modbusSlaveAllocateResponse(minion, 5);
+    if (!modbusIsOk(err)) {
+        return err;
+    }
+    memcpy(minion->response.pdu, requestPDU, 5);
+
+    baudrate_switch.pending = baud_rate;
+    return MODBUS_NO_ERROR();
+}
+
+
+/*
+ *  Delta read of the device status.
+ *  Request: function code, boot id (16 bit), change sequence last seen by the master (32 bit).
+ *  Response: function code, boot id (16 bit), current change sequence (32 bit), mask of the changed fields (16 bit),
+ *  then the value of every changed field in ascending order (32 bit for the work seconds, 16 bit for the others).
+ *  If the boot id does not match or the sequence is ahead of the current one every field is reported.
+ */
+static LIGHTMODBUS_RET_ERROR status_changes(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
+                                            uint8_t requestLength) {
+    // Check request length
+    if (requestLength < 7) {
+        return modbusBuildException(minion, function, MODBUS_EXCEP_ILLEGAL_VALUE);
+    }
+
+    easyconnect_interface_t *ctx = modbusSlaveGetUserPointer(minion);
+
+    uint16_t boot_id = 0;
+    uint32_t since   = 0;
+    deserialize_uint16_be(&boot_id, (uint8_t *)&requestPDU[1]);
+    deserialize_uint32_be(&since, (uint8_t *)&requestPDU[3]);
+
+    uint16_t current_boot_id = model_get_boot_id(ctx->arg);
+
+    uint16_t mask                     = 0;
+    uint32_t values[MODEL_STATUS_NUM] = {0};
+    uint32_t sequence                 = model_get_status_changes(ctx->arg, since, &mask, values);
+    if (boot_id != current_boot_id || since > sequence) {
+        // The master is out of sync (restart or stale sequence): fields never changed since boot have sequence 0
+        // and would be skipped by the filter, so every one of them is reported
+        mask = (1 << MODEL_STATUS_NUM) - 1;
+    }
+
+    uint16_t length = 9;
+    for (model_status_t field = 0; field < MODEL_STATUS_NUM; field++) {
+        if (mask & (1 << field)) {
+            length += field == MODEL_STATUS_WORK_SECONDS ? 4 : 2;
+        }
+    }
+
+    ModbusErrorInfo err = modbusSlaveAllocateResponse(minion, length);
+    if (!modbusIsOk(err)) {
+        return err;
+    }
+
+    uint8_t *pdu = minion->response.pdu;
+    size_t   i   = 0;
+    pdu[i++]     = function;
+    i += serialize_uint16_be(&pdu[i], current_boot_id);
+    i += serialize_uint32_be(&pdu[i], sequence);
+    i += serialize_uint16_be(&pdu[i], mask);
+    for (model_status_t field = 0; field < MODEL_STATUS_NUM; field++) {
+        if (mask & (1 << field)) {
+            if (field == MODEL_STATUS_WORK_SECONDS) {
+                i += serialize_uint32_be(&pdu[i], values[field]);
+            } else {
+                i += serialize_uint16_be(&pdu[i], (uint16_t)values[field]);
+            }
+        }
+    }
+
     return MODBUS_NO_ERROR();
 }
 
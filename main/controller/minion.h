@@ -6,7 +6,7 @@
 #include "easyconnect.h"
 
 
-void minion_init(easyconnect_interface_t *context);
-void minion_manage(void);
+void     minion_init(easyconnect_interface_t *context);
+uint16_t minion_get_heap_lost(void);
 
 #endif
\ No newline at end of file
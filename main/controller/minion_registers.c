@@ -0,0 +1,489 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lightmodbus/lightmodbus.h"
+#include "easyconnect.h"
+#include "config/app_config.h"
+#include "model/model.h"
+#include "peripherals/digout.h"
+#include "peripherals/digin.h"
+#include "event_log.h"
+#include "rele.h"
+#include "configuration.h"
+#include "minion.h"
+#include "minion_registers.h"
+
+
+#define HOLDING_REGISTER_SAFETY_MESSAGE   EASYCONNECT_HOLDING_REGISTER_MESSAGE_1
+#define HOLDING_REGISTER_FEEDBACK_MESSAGE (HOLDING_REGISTER_SAFETY_MESSAGE + EASYCONNECT_MESSAGE_NUM_REGISTERS)
+
+#define HOLDING_REGISTER_WORK_HOURS         EASYCONNECT_HOLDING_REGISTER_CUSTOM_START
+#define HOLDING_REGISTER_PERSISTENCE_STATUS (EASYCONNECT_HOLDING_REGISTER_CUSTOM_START + 1)
+#define HOLDING_REGISTER_HEAP_LOST          (EASYCONNECT_HOLDING_REGISTER_CUSTOM_START + 2)
+
+// The relay coil drives all the channels at once, the bank addresses them one by one
+#define COIL_RELE_STATE    0
+#define COIL_SAFETY_BYPASS 1
+#define COIL_RELE_CHANNELS 0x10
+
+/*
+ *  Input registers: snapshot of the whole device status, readable with a single FC04 request
+ */
+#define INPUT_REGISTER_STATUS_RELE_STATE      0
+#define INPUT_REGISTER_STATUS_ALARMS          1
+#define INPUT_REGISTER_STATUS_INPUTS          2
+#define INPUT_REGISTER_STATUS_OUTPUTS         3
+#define INPUT_REGISTER_STATUS_HEARTBEAT       4
+#define INPUT_REGISTER_STATUS_ATTEMPTS        5
+#define INPUT_REGISTER_STATUS_WORK_SECONDS_HI 6
+#define INPUT_REGISTER_STATUS_WORK_SECONDS_LO 7
+#define INPUT_REGISTER_STATUS_NUM             8
+
+/*
+ *  Input registers: one block for each relay channel
+ */
+#define INPUT_REGISTER_CHANNELS                0x10
+#define INPUT_REGISTER_CHANNEL_STATE           0
+#define INPUT_REGISTER_CHANNEL_ATTEMPTS        1
+#define INPUT_REGISTER_CHANNEL_WORK_SECONDS_HI 2
+#define INPUT_REGISTER_CHANNEL_WORK_SECONDS_LO 3
+#define INPUT_REGISTER_CHANNEL_FEEDBACK_MS     4
+#define INPUT_REGISTER_CHANNEL_NUM             5
+#define INPUT_REGISTER_CHANNELS_NUM            (APP_CONFIG_RELE_CHANNELS * INPUT_REGISTER_CHANNEL_NUM)
+
+#define REGISTER_R  0x01
+#define REGISTER_W  0x02
+#define REGISTER_RW (REGISTER_R | REGISTER_W)
+
+
+typedef uint16_t (*register_read_t)(easyconnect_interface_t *ctx, uint16_t offset);
+typedef ModbusExceptionCode (*register_write_t)(easyconnect_interface_t *ctx, uint16_t offset, uint16_t value);
+// Optional validation run for every register before any write of the request takes place
+typedef ModbusExceptionCode (*register_check_t)(easyconnect_interface_t *ctx, uint16_t offset, uint16_t value);
+
+typedef struct {
+    ModbusDataType   type;
+    uint16_t         first;
+    uint16_t         last;
+    uint8_t          access;
+    register_read_t  read;
+    register_write_t write;
+    register_check_t check;
+} register_descriptor_t;
+
+
+static uint16_t            read_address(easyconnect_interface_t *ctx, uint16_t offset);
+static uint16_t            read_firmware_version(easyconnect_interface_t *ctx, uint16_t offset);
+static uint16_t            read_class(easyconnect_interface_t *ctx, uint16_t offset);
+static uint16_t            read_serial_number(easyconnect_interface_t *ctx, uint16_t offset);
+static uint16_t            read_alarms(easyconnect_interface_t *ctx, uint16_t offset);
+static uint16_t            read_state(easyconnect_interface_t *ctx, uint16_t offset);
+static uint16_t            read_logs_counter(easyconnect_interface_t *ctx, uint16_t offset);
+static uint16_t            read_logs(easyconnect_interface_t *ctx, uint16_t offset);
+static uint16_t            read_safety_message(easyconnect_interface_t *ctx, uint16_t offset);
+static uint16_t            read_feedback_message(easyconnect_interface_t *ctx, uint16_t offset);
+static uint16_t            read_work_hours(easyconnect_interface_t *ctx, uint16_t offset);
+static uint16_t            read_persistence_status(easyconnect_interface_t *ctx, uint16_t offset);
+static uint16_t            read_heap_lost(easyconnect_interface_t *ctx, uint16_t offset);
+static uint16_t            read_rele_coil(easyconnect_interface_t *ctx, uint16_t offset);
+static uint16_t            read_safety_bypass_coil(easyconnect_interface_t *ctx, uint16_t offset);
+static uint16_t            read_discrete_input(easyconnect_interface_t *ctx, uint16_t offset);
+static uint16_t            read_status(easyconnect_interface_t *ctx, uint16_t offset);
+static uint16_t            read_channel_coil(easyconnect_interface_t *ctx, uint16_t offset);
+static uint16_t            read_channel(easyconnect_interface_t *ctx, uint16_t offset);
+static ModbusExceptionCode write_address(easyconnect_interface_t *ctx, uint16_t offset, uint16_t value);
+static ModbusExceptionCode write_class(easyconnect_interface_t *ctx, uint16_t offset, uint16_t value);
+static ModbusExceptionCode write_serial_number(easyconnect_interface_t *ctx, uint16_t offset, uint16_t value);
+static ModbusExceptionCode write_work_hours(easyconnect_interface_t *ctx, uint16_t offset, uint16_t value);
+static ModbusExceptionCode write_rele_coil(easyconnect_interface_t *ctx, uint16_t offset, uint16_t value);
+static ModbusExceptionCode write_safety_bypass_coil(easyconnect_interface_t *ctx, uint16_t offset, uint16_t value);
+static ModbusExceptionCode write_channel_coil(easyconnect_interface_t *ctx, uint16_t offset, uint16_t value);
+static ModbusExceptionCode check_class(easyconnect_interface_t *ctx, uint16_t offset, uint16_t value);
+
+
+/*
+ *  Register map: one entry for each register or block of consecutive registers,
+ *  X(name, type, first, last, access, read, write, check).
+ *  Ranges of the same type must not overlap; `find_register` turns every entry into a case range,
+ *  so an overlap is reported by the compiler as a duplicate case value.
+ */
+#define REGISTER_MAP(X)                                                                                                \
+    X(ADDRESS, MODBUS_HOLDING_REGISTER, EASYCONNECT_HOLDING_REGISTER_ADDRESS, EASYCONNECT_HOLDING_REGISTER_ADDRESS,    \
+      REGISTER_RW, read_address, write_address, NULL)                                                                  \
+    X(FIRMWARE_VERSION, MODBUS_HOLDING_REGISTER, EASYCONNECT_HOLDING_REGISTER_FIRMWARE_VERSION,                        \
+      EASYCONNECT_HOLDING_REGISTER_FIRMWARE_VERSION, REGISTER_R, read_firmware_version, NULL, NULL)                    \
+    X(CLASS, MODBUS_HOLDING_REGISTER, EASYCONNECT_HOLDING_REGISTER_CLASS, EASYCONNECT_HOLDING_REGISTER_CLASS,          \
+      REGISTER_RW, read_class, write_class, check_class)                                                               \
+    X(SERIAL_NUMBER, MODBUS_HOLDING_REGISTER, EASYCONNECT_HOLDING_REGISTER_SERIAL_NUMBER_1,                            \
+      EASYCONNECT_HOLDING_REGISTER_SERIAL_NUMBER_2, REGISTER_RW, read_serial_number, write_serial_number, NULL)        \
+    X(ALARMS, MODBUS_HOLDING_REGISTER, EASYCONNECT_HOLDING_REGISTER_ALARMS, EASYCONNECT_HOLDING_REGISTER_ALARMS,       \
+      REGISTER_R, read_alarms, NULL, NULL)                                                                             \
+    X(STATE, MODBUS_HOLDING_REGISTER, EASYCONNECT_HOLDING_REGISTER_STATE, EASYCONNECT_HOLDING_REGISTER_STATE,          \
+      REGISTER_R, read_state, NULL, NULL)                                                                              \
+    X(LOGS_COUNTER, MODBUS_HOLDING_REGISTER, EASYCONNECT_HOLDING_REGISTER_LOGS_COUNTER,                                \
+      EASYCONNECT_HOLDING_REGISTER_LOGS_COUNTER, REGISTER_R, read_logs_counter, NULL, NULL)                            \
+    X(LOGS, MODBUS_HOLDING_REGISTER, EASYCONNECT_HOLDING_REGISTER_LOGS, HOLDING_REGISTER_SAFETY_MESSAGE - 1,           \
+      REGISTER_R, read_logs, NULL, NULL)                                                                               \
+    X(SAFETY_MESSAGE, MODBUS_HOLDING_REGISTER, HOLDING_REGISTER_SAFETY_MESSAGE, HOLDING_REGISTER_FEEDBACK_MESSAGE - 1, \
+      REGISTER_R, read_safety_message, NULL, NULL)                                                                     \
+    X(FEEDBACK_MESSAGE, MODBUS_HOLDING_REGISTER, HOLDING_REGISTER_FEEDBACK_MESSAGE,                                    \
+      HOLDING_REGISTER_FEEDBACK_MESSAGE + EASYCONNECT_MESSAGE_NUM_REGISTERS - 1, REGISTER_R, read_feedback_message,    \
+      NULL, NULL)                                                                                                      \
+    X(WORK_HOURS, MODBUS_HOLDING_REGISTER, HOLDING_REGISTER_WORK_HOURS, HOLDING_REGISTER_WORK_HOURS, REGISTER_RW,      \
+      read_work_hours, write_work_hours, NULL)                                                                         \
+    X(PERSISTENCE_STATUS, MODBUS_HOLDING_REGISTER, HOLDING_REGISTER_PERSISTENCE_STATUS,                                \
+      HOLDING_REGISTER_PERSISTENCE_STATUS, REGISTER_R, read_persistence_status, NULL, NULL)                            \
+    X(HEAP_LOST, MODBUS_HOLDING_REGISTER, HOLDING_REGISTER_HEAP_LOST, HOLDING_REGISTER_HEAP_LOST, REGISTER_R,          \
+      read_heap_lost, NULL, NULL)                                                                                      \
+    X(RELE_COIL, MODBUS_COIL, COIL_RELE_STATE, COIL_RELE_STATE, REGISTER_RW, read_rele_coil, write_rele_coil, NULL)    \
+    X(SAFETY_BYPASS_COIL, MODBUS_COIL, COIL_SAFETY_BYPASS, COIL_SAFETY_BYPASS, REGISTER_RW, read_safety_bypass_coil,   \
+      write_safety_bypass_coil, NULL)                                                                                  \
+    X(CHANNEL_COILS, MODBUS_COIL, COIL_RELE_CHANNELS, COIL_RELE_CHANNELS + APP_CONFIG_RELE_CHANNELS - 1,               \
+      REGISTER_RW, read_channel_coil, write_channel_coil, NULL)                                                        \
+    X(DISCRETE_INPUTS, MODBUS_DISCRETE_INPUT, DIGIN_SAFETY, DIGIN_FEEDBACK(APP_CONFIG_RELE_CHANNELS - 1), REGISTER_R,  \
+      read_discrete_input, NULL, NULL)                                                                                 \
+    X(STATUS, MODBUS_INPUT_REGISTER, 0, INPUT_REGISTER_STATUS_NUM - 1, REGISTER_R, read_status, NULL, NULL)            \
+    X(CHANNELS, MODBUS_INPUT_REGISTER, INPUT_REGISTER_CHANNELS,                                                        \
+      INPUT_REGISTER_CHANNELS + INPUT_REGISTER_CHANNELS_NUM - 1, REGISTER_R, read_channel, NULL, NULL)
+
+
+#define REGISTER_ENUM(name, type, first, last, access, read, write, check) REGISTER_##name,
+#define REGISTER_DESCRIPTOR(name, type, first, last, access, read, write, check)                                       \
+    [REGISTER_##name] = {type, first, last, access, read, write, check},
+#define REGISTER_KEY(type, index) ((((uint32_t)(type)) << 16) | (uint32_t)(index))
+#define REGISTER_CASE(name, type, first, last, access, read, write, check)                                             \
+    case REGISTER_KEY(type, first) ... REGISTER_KEY(type, last):                                                       \
+        return &registers[REGISTER_##name];
+
+
+typedef enum {
+    REGISTER_MAP(REGISTER_ENUM) REGISTERS_NUM,
+} register_id_t;
+
+
+static const register_descriptor_t registers[REGISTERS_NUM] = {REGISTER_MAP(REGISTER_DESCRIPTOR)};
+
+
+static const register_descriptor_t *find_register(ModbusDataType type, uint16_t index);
+
+
+/*
+ *  Last serialized event; a multi-register read of the log touches the same event several times in a row
+ */
+static struct {
+    uint8_t valid;
+    size_t  index;
+    uint8_t buffer[EVENT_LOG_SERIALIZED_SIZE];
+} event_cache = {0};
+
+
+/*
+ *  Status block captured on the first read of a request, so that all registers come from the same instant
+ */
+static struct {
+    uint8_t  valid;
+    uint16_t registers[INPUT_REGISTER_STATUS_NUM];
+} status_cache = {0};
+
+
+/*
+ *  Same for the relay channels
+ */
+static struct {
+    uint8_t  valid;
+    uint16_t registers[INPUT_REGISTER_CHANNELS_NUM];
+} channels_cache = {0};
+
+
+/*
+ *  Holding register writes staged while a request is parsed and applied together once it has been accepted,
+ *  so that a multi-register write (FC16) never exposes a partial value and is persisted once.
+ *  Coils act on the relay and are still applied immediately.
+ */
+static struct {
+    uint8_t  address_written;
+    uint16_t address;
+    uint8_t  class_written;
+    uint16_t class;
+    // Bit n set if SERIAL_NUMBER_(n+1) was written
+    uint8_t  serial_number_written;
+    uint16_t serial_number[2];
+} staged = {0};
+
+
+void minion_registers_begin_request(void) {
+    // The log and the status may change between requests, never reuse them across requests
+    event_cache.valid    = 0;
+    status_cache.valid   = 0;
+    channels_cache.valid = 0;
+    memset(&staged, 0, sizeof(staged));
+}
+
+
+void minion_registers_end_request(easyconnect_interface_t *ctx) {
+    if (staged.address_written) {
+        ctx->save_address(ctx->arg, staged.address);
+    }
+    if (staged.class_written) {
+        ctx->save_class(ctx->arg, staged.class);
+    }
+    if (staged.serial_number_written) {
+        uint32_t serial_number = ctx->get_serial_number(ctx->arg);
+        if (staged.serial_number_written & 0x01) {
+            serial_number = ((uint32_t)staged.serial_number[0] << 16) | (serial_number & 0xFFFF);
+        }
+        if (staged.serial_number_written & 0x02) {
+            serial_number = staged.serial_number[1] | (serial_number & 0xFFFF0000);
+        }
+        ctx->save_serial_number(ctx->arg, serial_number);
+    }
+    memset(&staged, 0, sizeof(staged));
+}
+
+
+ModbusError minion_registers_access(easyconnect_interface_t *ctx, const ModbusRegisterCallbackArgs *args,
+                                    ModbusRegisterCallbackResult *result) {
+    const register_descriptor_t *reg = find_register(args->type, args->index);
+    result->value                    = 0;
+    result->exceptionCode            = MODBUS_EXCEP_NONE;
+
+    switch (args->query) {
+        // R/W access check
+        case MODBUS_REGQ_R_CHECK:
+            // Unmapped registers read as zero
+            break;
+
+        case MODBUS_REGQ_W_CHECK:
+            if (reg == NULL || (reg->access & REGISTER_W) == 0) {
+                result->exceptionCode = MODBUS_EXCEP_ILLEGAL_FUNCTION;
+            } else if (reg->check != NULL) {
+                result->exceptionCode = reg->check(ctx, args->index - reg->first, args->value);
+            }
+            break;
+
+        // Read register
+        case MODBUS_REGQ_R:
+            if (reg != NULL && (reg->access & REGISTER_R) != 0) {
+                result->value = reg->read(ctx, args->index - reg->first);
+            }
+            break;
+
+        // Write register
+        case MODBUS_REGQ_W:
+            if (reg != NULL && (reg->access & REGISTER_W) != 0) {
+                result->exceptionCode = reg->write(ctx, args->index - reg->first, args->value);
+            }
+            break;
+    }
+
+    // Always return MODBUS_OK
+    return MODBUS_OK;
+}
+
+
+/*
+ *  The switch compiles to a jump table or a binary search over the ranges
+ */
+static const register_descriptor_t *find_register(ModbusDataType type, uint16_t index) {
+    switch (REGISTER_KEY(type, index)) {
+        REGISTER_MAP(REGISTER_CASE)
+
+        default:
+            return NULL;
+    }
+}
+
+
+static uint16_t read_address(easyconnect_interface_t *ctx, uint16_t offset) {
+    return ctx->get_address(ctx->arg);
+}
+
+
+static uint16_t read_firmware_version(easyconnect_interface_t *ctx, uint16_t offset) {
+    return EASYCONNECT_FIRMWARE_VERSION(APP_CONFIG_FIRMWARE_VERSION_MAJOR, APP_CONFIG_FIRMWARE_VERSION_MINOR,
+                                        APP_CONFIG_FIRMWARE_VERSION_PATCH);
+}
+
+
+static uint16_t read_class(easyconnect_interface_t *ctx, uint16_t offset) {
+    return ctx->get_class(ctx->arg);
+}
+
+
+static uint16_t read_serial_number(easyconnect_interface_t *ctx, uint16_t offset) {
+    uint32_t serial_number = ctx->get_serial_number(ctx->arg);
+    return offset == 0 ? (serial_number >> 16) & 0xFFFF : serial_number & 0xFFFF;
+}
+
+
+static uint16_t read_alarms(easyconnect_interface_t *ctx, uint16_t offset) {
+    return model_get_status(ctx->arg, MODEL_STATUS_ALARMS);
+}
+
+
+static uint16_t read_state(easyconnect_interface_t *ctx, uint16_t offset) {
+    return rele_is_on();
+}
+
+
+static uint16_t read_logs_counter(easyconnect_interface_t *ctx, uint16_t offset) {
+    return event_log_get_count();
+}
+
+
+static uint16_t read_logs(easyconnect_interface_t *ctx, uint16_t offset) {
+    size_t event_index = offset / EVENT_LOG_SERIALIZED_SIZE;
+
+    if (!event_cache.valid || event_cache.index != event_index) {
+        memset(event_cache.buffer, 0, sizeof(event_cache.buffer));
+        event_log_serialize_event(event_cache.buffer, event_index);
+        event_cache.index = event_index;
+        event_cache.valid = 1;
+    }
+
+    size_t buffer_index = offset % 8;
+    return (event_cache.buffer[buffer_index] << 8) | event_cache.buffer[buffer_index + 1];
+}
+
+
+static uint16_t read_safety_message(easyconnect_interface_t *ctx, uint16_t offset) {
+    char msg[EASYCONNECT_MESSAGE_SIZE + 1] = {0};
+    model_get_safety_message(ctx->arg, msg);
+    return msg[offset * 2] << 8 | msg[offset * 2 + 1];
+}
+
+
+static uint16_t read_feedback_message(easyconnect_interface_t *ctx, uint16_t offset) {
+    char msg[EASYCONNECT_MESSAGE_SIZE + 1] = {0};
+    model_get_feedback_message(ctx->arg, msg);
+    return msg[offset * 2] << 8 | msg[offset * 2 + 1];
+}
+
+
+static uint16_t read_work_hours(easyconnect_interface_t *ctx, uint16_t offset) {
+    return model_get_work_hours(ctx->arg);
+}
+
+
+static uint16_t read_persistence_status(easyconnect_interface_t *ctx, uint16_t offset) {
+    return configuration_get_persistence_status();
+}
+
+
+static uint16_t read_heap_lost(easyconnect_interface_t *ctx, uint16_t offset) {
+    return minion_get_heap_lost();
+}
+
+
+static uint16_t read_rele_coil(easyconnect_interface_t *ctx, uint16_t offset) {
+    return digout_get() != 0;
+}
+
+
+static uint16_t read_safety_bypass_coil(easyconnect_interface_t *ctx, uint16_t offset) {
+    return model_get_safety_bypass(ctx->arg);
+}
+
+
+static uint16_t read_discrete_input(easyconnect_interface_t *ctx, uint16_t offset) {
+    return digin_get(offset);
+}
+
+
+static uint16_t read_status(easyconnect_interface_t *ctx, uint16_t offset) {
+    if (!status_cache.valid) {
+        model_t snapshot;
+        model_get_snapshot(ctx->arg, &snapshot);
+
+        uint16_t *registers                              = status_cache.registers;
+        registers[INPUT_REGISTER_STATUS_RELE_STATE]      = snapshot.status[MODEL_STATUS_RELE_STATE].value;
+        registers[INPUT_REGISTER_STATUS_ALARMS]          = snapshot.status[MODEL_STATUS_ALARMS].value;
+        registers[INPUT_REGISTER_STATUS_INPUTS]          = snapshot.status[MODEL_STATUS_INPUTS].value;
+        registers[INPUT_REGISTER_STATUS_OUTPUTS]         = snapshot.status[MODEL_STATUS_OUTPUTS].value;
+        registers[INPUT_REGISTER_STATUS_HEARTBEAT]       = snapshot.status[MODEL_STATUS_HEARTBEAT].value;
+        registers[INPUT_REGISTER_STATUS_ATTEMPTS]        = snapshot.status[MODEL_STATUS_ATTEMPTS].value;
+        registers[INPUT_REGISTER_STATUS_WORK_SECONDS_HI] = (snapshot.status[MODEL_STATUS_WORK_SECONDS].value >> 16);
+        registers[INPUT_REGISTER_STATUS_WORK_SECONDS_LO] = snapshot.status[MODEL_STATUS_WORK_SECONDS].value & 0xFFFF;
+        status_cache.valid                               = 1;
+    }
+
+    return status_cache.registers[offset];
+}
+
+
+static uint16_t read_channel_coil(easyconnect_interface_t *ctx, uint16_t offset) {
+    return (digout_get() >> offset) & 0x01;
+}
+
+
+static uint16_t read_channel(easyconnect_interface_t *ctx, uint16_t offset) {
+    if (!channels_cache.valid) {
+        for (size_t channel = 0; channel < APP_CONFIG_RELE_CHANNELS; channel++) {
+            uint16_t *registers    = &channels_cache.registers[channel * INPUT_REGISTER_CHANNEL_NUM];
+            uint32_t  work_seconds = rele_get_channel_work_seconds(channel);
+
+            registers[INPUT_REGISTER_CHANNEL_STATE]           = rele_is_channel_on(channel);
+            registers[INPUT_REGISTER_CHANNEL_ATTEMPTS]        = rele_get_channel_attempts(channel);
+            registers[INPUT_REGISTER_CHANNEL_WORK_SECONDS_HI] = work_seconds >> 16;
+            registers[INPUT_REGISTER_CHANNEL_WORK_SECONDS_LO] = work_seconds & 0xFFFF;
+            registers[INPUT_REGISTER_CHANNEL_FEEDBACK_MS]     = rele_get_channel_feedback_latency(channel);
+        }
+        channels_cache.valid = 1;
+    }
+
+    return channels_cache.registers[offset];
+}
+
+
+static ModbusExceptionCode write_address(easyconnect_interface_t *ctx, uint16_t offset, uint16_t value) {
+    staged.address         = value;
+    staged.address_written = 1;
+    return MODBUS_EXCEP_NONE;
+}
+
+
+static ModbusExceptionCode write_class(easyconnect_interface_t *ctx, uint16_t offset, uint16_t value) {
+    staged.class         = value;
+    staged.class_written = 1;
+    return MODBUS_EXCEP_NONE;
+}
+
+
+static ModbusExceptionCode check_class(easyconnect_interface_t *ctx, uint16_t offset, uint16_t value) {
+    return model_is_valid_class(value) ? MODBUS_EXCEP_NONE : MODBUS_EXCEP_ILLEGAL_VALUE;
+}
+
+
+static ModbusExceptionCode write_serial_number(easyconnect_interface_t *ctx, uint16_t offset, uint16_t value) {
+    staged.serial_number[offset] = value;
+    staged.serial_number_written |= 1 << offset;
+    return MODBUS_EXCEP_NONE;
+}
+
+
+static ModbusExceptionCode write_work_hours(easyconnect_interface_t *ctx, uint16_t offset, uint16_t value) {
+    model_reset_work_seconds(ctx->arg);
+    return MODBUS_EXCEP_NONE;
+}
+
+
+static ModbusExceptionCode write_rele_coil(easyconnect_interface_t *ctx, uint16_t offset, uint16_t value) {
+    if (rele_update(ctx->arg, value)) {
+        return MODBUS_EXCEP_SLAVE_FAILURE;
+    }
+    return MODBUS_EXCEP_NONE;
+}
+
+
+static ModbusExceptionCode write_safety_bypass_coil(easyconnect_interface_t *ctx, uint16_t offset, uint16_t value) {
+    model_set_safety_bypass(ctx->arg, value);
+    return MODBUS_EXCEP_NONE;
+}
+
+
+static ModbusExceptionCode write_channel_coil(easyconnect_interface_t *ctx, uint16_t offset, uint16_t value) {
+    if (rele_update_channel(ctx->arg, offset, value)) {
+        return MODBUS_EXCEP_SLAVE_FAILURE;
+    }
+    return MODBUS_EXCEP_NONE;
+}
@@ -0,0 +1,15 @@
+#ifndef MINION_REGISTERS_H_INCLUDED
+#define MINION_REGISTERS_H_INCLUDED
+
+
+#include "lightmodbus/lightmodbus.h"
+#include "easyconnect.h"
+
+
+void        minion_registers_begin_request(void);
+void        minion_registers_end_request(easyconnect_interface_t *ctx);
+ModbusError minion_registers_access(easyconnect_interface_t *ctx, const ModbusRegisterCallbackArgs *args,
+                                    ModbusRegisterCallbackResult *result);
+
+
+#endif
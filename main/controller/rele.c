@@ -1,3 +1,6 @@
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "freertos/timers.h"
@@ -12,8 +15,12 @@
 #include "peripherals/digin.h"
 #include "rele.h"
 #include "gel/state_machine/state_machine.h"
-#include "gel/timer/timer.h"
+#include "utils/event_loop.h"
 #include "event_log.h"
+#include "esp_timer.h"
+
+
+#include "config/app_config.h"
 
 
 typedef enum {
@@ -31,29 +38,73 @@ typedef enum {
     RELE_EVENT_ON,
     RELE_EVENT_CHECK_FEEDBACK,
     RELE_EVENT_RETRY,
+    RELE_EVENT_FEEDBACK_STABLE,
 } rele_event_t;
 
 
-DEFINE_STATE_MACHINE(rele, rele_event_t, model_t);
+// Channel masks (outputs, coils) are 8 bits wide
+_Static_assert(APP_CONFIG_RELE_CHANNELS >= 1 && APP_CONFIG_RELE_CHANNELS <= 8, "From 1 to 8 relay channels");
+
+
+typedef struct rele_channel rele_channel_t;
+
+DEFINE_STATE_MACHINE(rele, rele_event_t, rele_channel_t);
+
+
+/*
+ *  One relay output with its feedback input; every channel runs its own state machine and timers
+ */
+struct rele_channel {
+    size_t               index;
+    model_t             *pmodel;
+    rele_state_machine_t sm;
+    scheduler_timer_t    check_timer;
+    scheduler_timer_t    retry_timer;
+    scheduler_timer_t    stable_timer;
+    uint8_t              attempts;
+    uint8_t              attempts_exceeded;
+    // Start of the current activation, 0 if not running
+    unsigned long timestamp;
+    // Completed activations since boot; the persistent counter in the model is the total of all channels
+    uint32_t work_seconds;
+    // When the output was last energized waiting for the feedback, and the edge of the matching feedback
+    // (esp_timer microseconds)
+    int64_t energized_us;
+    int64_t feedback_us;
+    uint8_t feedback_seen;
+    // Last measured time between energizing the output and the feedback
+    uint16_t feedback_latency_ms;
+};
 
 
-static int     on_event_manager(model_t *pmodel, rele_event_t event);
-static int     on_waiting_fb_event_manager(model_t *pmodel, rele_event_t event);
-static int     off_event_manager(model_t *pmodel, rele_event_t event);
-static int     off_waiting_fb_event_manager(model_t *pmodel, rele_event_t event);
-static void    timer_callback(gel_timer_t *timer, void *arg, void *code);
-static int     error_event_manager(model_t *pmodel, rele_event_t event);
-static int     turn_on(model_t *pmodel);
-static void    turn_off(model_t *pmodel);
-static uint8_t can_turn_on(model_t *pmodel);
+static int     on_event_manager(rele_channel_t *channel, rele_event_t event);
+static int     on_waiting_fb_event_manager(rele_channel_t *channel, rele_event_t event);
+static int     off_event_manager(rele_channel_t *channel, rele_event_t event);
+static int     off_waiting_fb_event_manager(rele_channel_t *channel, rele_event_t event);
+static int     error_event_manager(rele_channel_t *channel, rele_event_t event);
+static void    check_timer_callback(void *arg);
+static void    retry_timer_callback(void *arg);
+static void    stable_timer_callback(void *arg);
+static void    start_confirmation(rele_channel_t *channel);
+static void    watch_feedback(rele_channel_t *channel);
+static int     confirm_feedback(rele_channel_t *channel);
+static void    stop_confirmation(rele_channel_t *channel);
+static int     send_event(rele_channel_t *channel, rele_event_t event);
+static int     turn_on(rele_channel_t *channel);
+static void    turn_off(rele_channel_t *channel);
+static uint8_t can_turn_on(rele_channel_t *channel);
+static void    set_attempts_exceeded(rele_channel_t *channel, uint8_t value);
+
+static inline __attribute__((always_inline)) void set_rele(rele_channel_t *channel, uint8_t value) {
+    digout_update(DIGOUT_RELE_CHANNEL(channel->index), value);
+}
 
-static inline __attribute__((always_inline)) void set_rele(uint8_t value) {
-    digout_update(DIGOUT_RELE, value);
+static inline __attribute__((always_inline)) int read_feedback(rele_channel_t *channel) {
+    return digin_get(DIGIN_FEEDBACK(channel->index));
 }
 
 
-static const char   *TAG       = "Rele";
-static unsigned long timestamp = 0;
+static const char *TAG = "Rele";
 
 
 static rele_event_manager_t managers[] = {
@@ -62,60 +113,164 @@ static rele_event_manager_t managers[] = {
     [RELE_SM_STATE_ERROR] = error_event_manager,
 };
 
-static rele_state_machine_t sm = {
-    .state    = RELE_SM_STATE_OFF,
-    .managers = managers,
-};
+static rele_channel_t    channels[APP_CONFIG_RELE_CHANNELS];
+static SemaphoreHandle_t sem = NULL;
 
-static gel_timer_t check_timer = GEL_TIMER_NULL;
-static gel_timer_t retry_timer = GEL_TIMER_NULL;
-static uint8_t     attempts    = 0;
 
+void rele_init(model_t *pmodel) {
+    static StaticSemaphore_t semaphore_buffer;
+    sem = xSemaphoreCreateMutexStatic(&semaphore_buffer);
 
+    for (size_t i = 0; i < APP_CONFIG_RELE_CHANNELS; i++) {
+        rele_channel_t *channel = &channels[i];
+        memset(channel, 0, sizeof(*channel));
+        channel->index       = i;
+        channel->pmodel      = pmodel;
+        channel->sm.state    = RELE_SM_STATE_OFF;
+        channel->sm.managers = managers;
+        scheduler_timer_init(&channel->check_timer, check_timer_callback, channel);
+        scheduler_timer_init(&channel->retry_timer, retry_timer_callback, channel);
+        scheduler_timer_init(&channel->stable_timer, stable_timer_callback, channel);
+    }
+}
+
+
+/*
+ *  Drives every channel at once; returns 0 if at least one of them accepted the command, -1 otherwise
+ */
 int rele_update(model_t *pmodel, uint8_t value) {
-    return rele_sm_send_event(&sm, pmodel, value ? RELE_EVENT_ON : RELE_EVENT_OFF) ? 0 : -1;
+    int res = -1;
+    for (size_t i = 0; i < APP_CONFIG_RELE_CHANNELS; i++) {
+        if (rele_update_channel(pmodel, i, value) == 0) {
+            res = 0;
+        }
+    }
+    return res;
+}
+
+
+int rele_update_channel(model_t *pmodel, size_t channel, uint8_t value) {
+    (void)pmodel;
+    assert(channel < APP_CONFIG_RELE_CHANNELS);
+    return send_event(&channels[channel], value ? RELE_EVENT_ON : RELE_EVENT_OFF) ? 0 : -1;
 }
 
 
 uint8_t rele_is_on(void) {
-    return sm.state != RELE_SM_STATE_OFF;
+    return rele_get_channels_on() != 0;
+}
+
+
+uint8_t rele_is_channel_on(size_t channel) {
+    assert(channel < APP_CONFIG_RELE_CHANNELS);
+    return channels[channel].sm.state != RELE_SM_STATE_OFF;
+}
+
+
+/*
+ *  Bit n is set if channel n is on
+ */
+uint16_t rele_get_channels_on(void) {
+    uint16_t mask = 0;
+    for (size_t i = 0; i < APP_CONFIG_RELE_CHANNELS; i++) {
+        if (rele_is_channel_on(i)) {
+            mask |= 1 << i;
+        }
+    }
+    return mask;
+}
+
+
+/*
+ *  Highest attempt count among the channels
+ */
+uint8_t rele_get_attempts(void) {
+    uint8_t attempts = 0;
+    for (size_t i = 0; i < APP_CONFIG_RELE_CHANNELS; i++) {
+        if (channels[i].attempts > attempts) {
+            attempts = channels[i].attempts;
+        }
+    }
+    return attempts;
+}
+
+
+uint8_t rele_get_channel_attempts(size_t channel) {
+    assert(channel < APP_CONFIG_RELE_CHANNELS);
+    return channels[channel].attempts;
+}
+
+
+uint16_t rele_get_channel_feedback_latency(size_t channel) {
+    assert(channel < APP_CONFIG_RELE_CHANNELS);
+    return channels[channel].feedback_latency_ms;
+}
+
+
+/*
+ *  Seconds of the activations in progress, not yet added to the work seconds
+ */
+uint32_t rele_get_running_seconds(void) {
+    uint32_t seconds = 0;
+    for (size_t i = 0; i < APP_CONFIG_RELE_CHANNELS; i++) {
+        unsigned long start = channels[i].timestamp;
+        seconds += start != 0 ? time_interval(start, get_millis()) / 1000UL : 0;
+    }
+    return seconds;
+}
+
+
+/*
+ *  Work seconds of a single channel since boot, including the activation in progress
+ */
+uint32_t rele_get_channel_work_seconds(size_t channel) {
+    assert(channel < APP_CONFIG_RELE_CHANNELS);
+    unsigned long start   = channels[channel].timestamp;
+    uint32_t      running = start != 0 ? time_interval(start, get_millis()) / 1000UL : 0;
+    return channels[channel].work_seconds + running;
 }
 
 
 void rele_refresh(model_t *pmodel) {
-    rele_sm_send_event(&sm, pmodel, RELE_EVENT_REFRESH);
+    (void)pmodel;
+    for (size_t i = 0; i < APP_CONFIG_RELE_CHANNELS; i++) {
+        send_event(&channels[i], RELE_EVENT_REFRESH);
+    }
 }
 
 
-void rele_manage(model_t *pmodel) {
-    gel_timer_manage_callbacks(&check_timer, 1, get_millis(), pmodel);
-    gel_timer_manage_callbacks(&retry_timer, 1, get_millis(), pmodel);
+static int send_event(rele_channel_t *channel, rele_event_t event) {
+    xSemaphoreTake(sem, portMAX_DELAY);
+    int res = rele_sm_send_event(&channel->sm, channel, event);
+    xSemaphoreGive(sem);
+    return res;
 }
 
 
-static int on_event_manager(model_t *pmodel, rele_event_t event) {
+static int on_event_manager(rele_channel_t *channel, rele_event_t event) {
+    model_t *pmodel = channel->pmodel;
+
     switch (event) {
         case RELE_EVENT_OFF:
-            turn_off(pmodel);
+            turn_off(channel);
             return RELE_SM_STATE_OFF;
 
         case RELE_EVENT_REFRESH:
-            if (can_turn_on(pmodel)) {
+            if (can_turn_on(channel)) {
                 if (model_is_safety_mode(pmodel)) {
-                    return turn_on(pmodel);
+                    return turn_on(channel);
                 }
             } else {
-                turn_off(pmodel);
-                ESP_LOGW(TAG, "Safety signal off; going to error state");
+                turn_off(channel);
+                ESP_LOGW(TAG, "Safety signal off on channel %i; going to error state", (int)channel->index);
                 return RELE_SM_STATE_ERROR;
             }
 
             if (!model_is_safety_mode(pmodel)) {
                 if (model_get_feedback_enabled(pmodel) &&
-                    digin_get(DIGIN_SIGNAL) != model_get_feedback_direction(pmodel)) {
-                    turn_off(pmodel);
-                    gel_timer_activate(&retry_timer, model_get_feedback_delay(pmodel) * 1000UL, get_millis(),
-                                       timer_callback, (void *)(uintptr_t)RELE_EVENT_RETRY);
+                    read_feedback(channel) != model_get_feedback_direction(pmodel)) {
+                    turn_off(channel);
+                    event_loop_arm(&channel->retry_timer, model_get_feedback_delay(pmodel) * 1000UL);
                     return RELE_SM_STATE_OFF_WAITING_FB;
                 }
             }
@@ -130,36 +285,49 @@ static int on_event_manager(model_t *pmodel, rele_event_t event) {
 }
 
 
-static int on_waiting_fb_event_manager(model_t *pmodel, rele_event_t event) {
+static int on_waiting_fb_event_manager(rele_channel_t *channel, rele_event_t event) {
+    model_t *pmodel = channel->pmodel;
+
     switch (event) {
         case RELE_EVENT_OFF:
-            set_rele(0);
+            stop_confirmation(channel);
+            set_rele(channel, 0);
             return RELE_SM_STATE_OFF;
 
         case RELE_EVENT_REFRESH:
-            if (can_turn_on(pmodel)) {
+            if (can_turn_on(channel)) {
+                watch_feedback(channel);
             } else {
-                set_rele(0);
+                stop_confirmation(channel);
+                set_rele(channel, 0);
                 return RELE_SM_STATE_OFF;
             }
 
             return -1;
 
+        case RELE_EVENT_FEEDBACK_STABLE:
+            if (read_feedback(channel) == model_get_feedback_direction(pmodel)) {
+                return confirm_feedback(channel);
+            }
+            return -1;
+
         case RELE_EVENT_CHECK_FEEDBACK:
-            if (digin_get(DIGIN_SIGNAL) == model_get_feedback_direction(pmodel)) {
-                attempts = 0;
-                return RELE_SM_STATE_ON;
-            } else if (attempts < model_get_output_attempts(pmodel) - 1) {
-                attempts++;
-                ESP_LOGI(TAG, "Feedback invalid, attempt %i", attempts);
-                set_rele(0);
-                gel_timer_activate(&retry_timer, model_get_feedback_delay(pmodel) * 1000, get_millis(), timer_callback,
-                                   (void *)(uintptr_t)RELE_EVENT_RETRY);
+            // Feedback delay elapsed: last chance for the feedback
+            if (read_feedback(channel) == model_get_feedback_direction(pmodel)) {
+                return confirm_feedback(channel);
+            }
+
+            stop_confirmation(channel);
+            if (channel->attempts < model_get_output_attempts(pmodel) - 1) {
+                channel->attempts++;
+                ESP_LOGI(TAG, "Feedback invalid on channel %i, attempt %i", (int)channel->index, channel->attempts);
+                set_rele(channel, 0);
+                event_loop_arm(&channel->retry_timer, model_get_feedback_delay(pmodel) * 1000UL);
                 return RELE_SM_STATE_OFF_WAITING_FB;
             } else {
-                model_set_output_attempts_exceeded(pmodel, 1);
-                set_rele(0);
-                ESP_LOGI(TAG, "No more attempts");
+                set_attempts_exceeded(channel, 1);
+                set_rele(channel, 0);
+                ESP_LOGI(TAG, "No more attempts on channel %i", (int)channel->index);
                 return RELE_SM_STATE_OFF;
             }
 
@@ -169,27 +337,30 @@ static int on_waiting_fb_event_manager(model_t *pmodel, rele_event_t event) {
 }
 
 
-static int off_event_manager(model_t *pmodel, rele_event_t event) {
+static int off_event_manager(rele_channel_t *channel, rele_event_t event) {
+    model_t *pmodel = channel->pmodel;
+
     switch (event) {
         case RELE_EVENT_ON:
-            if (can_turn_on(pmodel)) {
-                return turn_on(pmodel);
+            if (can_turn_on(channel)) {
+                return turn_on(channel);
             } else {
                 // Go to error state
-                ESP_LOGW(TAG, "Safety signal off, cannot turn on; going to error state");
+                ESP_LOGW(TAG, "Safety signal off, cannot turn on channel %i; going to error state",
+                         (int)channel->index);
                 return RELE_SM_STATE_ERROR;
             }
 
         case RELE_EVENT_REFRESH:
             // Change safety signal only if there is no standing error
-            if (!model_get_output_attempts_exceeded(pmodel)) {
-                if (can_turn_on(pmodel)) {
+            if (!channel->attempts_exceeded) {
+                if (can_turn_on(channel)) {
                 } else {
                 }
             }
 
-            if (model_is_safety_mode(pmodel) && can_turn_on(pmodel)) {
-                return turn_on(pmodel);
+            if (model_is_safety_mode(pmodel) && can_turn_on(channel)) {
+                return turn_on(channel);
             }
 
             return -1;
@@ -200,14 +371,14 @@ static int off_event_manager(model_t *pmodel, rele_event_t event) {
 }
 
 
-static int off_waiting_fb_event_manager(model_t *pmodel, rele_event_t event) {
+static int off_waiting_fb_event_manager(rele_channel_t *channel, rele_event_t event) {
     switch (event) {
         case RELE_EVENT_ON:
-            attempts = 0;
+            channel->attempts = 0;
             return -1;
 
         case RELE_EVENT_REFRESH:
-            if (can_turn_on(pmodel)) {
+            if (can_turn_on(channel)) {
             } else {
                 return RELE_SM_STATE_OFF;
             }
@@ -217,10 +388,9 @@ static int off_waiting_fb_event_manager(model_t *pmodel, rele_event_t event) {
             return RELE_SM_STATE_OFF;
 
         case RELE_EVENT_RETRY:
-            ESP_LOGI(TAG, "Retrying");
-            set_rele(1);
-            gel_timer_activate(&check_timer, model_get_feedback_delay(pmodel) * 1000UL, get_millis(), timer_callback,
-                               (void *)(uintptr_t)RELE_EVENT_CHECK_FEEDBACK);
+            ESP_LOGI(TAG, "Retrying channel %i", (int)channel->index);
+            set_rele(channel, 1);
+            start_confirmation(channel);
             return RELE_SM_STATE_ON_WAITING_FB;
 
         default:
@@ -229,7 +399,7 @@ static int off_waiting_fb_event_manager(model_t *pmodel, rele_event_t event) {
 }
 
 
-static int error_event_manager(model_t *pmodel, rele_event_t event) {
+static int error_event_manager(rele_channel_t *channel, rele_event_t event) {
     switch (event) {
         case RELE_EVENT_OFF:
             // Just go to off state
@@ -237,9 +407,9 @@ static int error_event_manager(model_t *pmodel, rele_event_t event) {
 
         case RELE_EVENT_ON:
         case RELE_EVENT_REFRESH:
-            if (can_turn_on(pmodel)) {
+            if (can_turn_on(channel)) {
                 // Safety is OK again, turn on
-                return turn_on(pmodel);
+                return turn_on(channel);
             } else {
                 return -1;
             }
@@ -250,14 +420,80 @@ static int error_event_manager(model_t *pmodel, rele_event_t event) {
 }
 
 
-static void timer_callback(gel_timer_t *timer, void *arg, void *code) {
-    rele_sm_send_event(&sm, arg, (rele_event_t)(uintptr_t)code);
+static void check_timer_callback(void *arg) {
+    send_event(arg, RELE_EVENT_CHECK_FEEDBACK);
 }
 
 
-static int turn_on(model_t *pmodel) {
-    set_rele(1);
-    model_set_output_attempts_exceeded(pmodel, 0);
+static void retry_timer_callback(void *arg) {
+    send_event(arg, RELE_EVENT_RETRY);
+}
+
+
+static void stable_timer_callback(void *arg) {
+    send_event(arg, RELE_EVENT_FEEDBACK_STABLE);
+}
+
+
+/*
+ *  The output was just energized: the feedback is confirmed as soon as it is stable (see watch_feedback),
+ *  the check timer only marks the timeout
+ */
+static void start_confirmation(rele_channel_t *channel) {
+    channel->energized_us  = esp_timer_get_time();
+    channel->feedback_seen = 0;
+    event_loop_arm(&channel->check_timer, model_get_feedback_delay(channel->pmodel) * 1000UL);
+    // The contact might be closed already
+    watch_feedback(channel);
+}
+
+
+/*
+ *  Called on every input change while waiting for the feedback: a matching feedback starts the stability window,
+ *  a bounce back cancels it
+ */
+static void watch_feedback(rele_channel_t *channel) {
+    if (read_feedback(channel) == model_get_feedback_direction(channel->pmodel)) {
+        if (!channel->feedback_seen) {
+            channel->feedback_seen = 1;
+            channel->feedback_us   = digin_get_edge_time(DIGIN_FEEDBACK(channel->index));
+#if APP_CONFIG_FEEDBACK_STABLE_MS > 0
+            event_loop_arm(&channel->stable_timer, APP_CONFIG_FEEDBACK_STABLE_MS);
+#endif
+        }
+    } else if (channel->feedback_seen) {
+        channel->feedback_seen = 0;
+        event_loop_cancel(&channel->stable_timer);
+    }
+}
+
+
+static int confirm_feedback(rele_channel_t *channel) {
+    int64_t end = channel->feedback_seen ? channel->feedback_us : esp_timer_get_time();
+    // A contact that was already closed before energizing the output counts as immediate
+    int64_t latency = end > channel->energized_us ? (end - channel->energized_us) / 1000 : 0;
+    channel->feedback_latency_ms = latency > UINT16_MAX ? UINT16_MAX : (uint16_t)latency;
+    ESP_LOGI(TAG, "Feedback confirmed on channel %i after %i ms", (int)channel->index,
+             (int)channel->feedback_latency_ms);
+
+    stop_confirmation(channel);
+    channel->attempts = 0;
+    return RELE_SM_STATE_ON;
+}
+
+
+static void stop_confirmation(rele_channel_t *channel) {
+    event_loop_cancel(&channel->check_timer);
+    event_loop_cancel(&channel->stable_timer);
+    channel->feedback_seen = 0;
+}
+
+
+static int turn_on(rele_channel_t *channel) {
+    model_t *pmodel = channel->pmodel;
+
+    set_rele(channel, 1);
+    set_attempts_exceeded(channel, 0);
 
     switch (CLASS_GET_MODE(model_get_class(pmodel))) {
         case DEVICE_MODE_SAFETY:
@@ -265,11 +501,10 @@ static int turn_on(model_t *pmodel) {
 
         case DEVICE_MODE_UVC:
         case DEVICE_MODE_ESF:
-            timestamp = get_millis();
+            channel->timestamp = get_millis();
             if (model_get_feedback_enabled(pmodel)) {
-                gel_timer_activate(&check_timer, model_get_feedback_delay(pmodel) * 1000UL, get_millis(),
-                                   timer_callback, (void *)(uintptr_t)RELE_EVENT_CHECK_FEEDBACK);
-                attempts = 0;
+                channel->attempts = 0;
+                start_confirmation(channel);
                 return RELE_SM_STATE_ON_WAITING_FB;
             } else {
                 return RELE_SM_STATE_ON;
@@ -284,11 +519,12 @@ static int turn_on(model_t *pmodel) {
 }
 
 
-static uint8_t can_turn_on(model_t *pmodel) {
+static uint8_t can_turn_on(rele_channel_t *channel) {
+    model_t *pmodel = channel->pmodel;
+
     switch (CLASS_GET_MODE(model_get_class(pmodel))) {
         case DEVICE_MODE_UVC:
         case DEVICE_MODE_ESF:
-            // printf("%i %i\n", safety_ok(), model_get_safety_bypass(pmodel));
             return (safety_ok() || model_get_safety_bypass(pmodel)) && !model_get_missing_heartbeat(pmodel);
         case DEVICE_MODE_SAFETY:
             return safety_ok();
@@ -299,11 +535,26 @@ static uint8_t can_turn_on(model_t *pmodel) {
 }
 
 
-static void turn_off(model_t *pmodel) {
-    set_rele(0);
-    if (timestamp != 0) {
-        model_increase_work_seconds(pmodel, time_interval(timestamp, get_millis()) / 1000UL);
-        // model_increase_work_seconds(pmodel, 60UL * 60UL * 100UL);
-        timestamp = 0;
+static void turn_off(rele_channel_t *channel) {
+    set_rele(channel, 0);
+    if (channel->timestamp != 0) {
+        uint32_t seconds = time_interval(channel->timestamp, get_millis()) / 1000UL;
+        channel->work_seconds += seconds;
+        model_increase_work_seconds(channel->pmodel, seconds);
+        channel->timestamp = 0;
+    }
+}
+
+
+/*
+ *  The alarm in the model is raised as long as any channel ran out of attempts
+ */
+static void set_attempts_exceeded(rele_channel_t *channel, uint8_t value) {
+    channel->attempts_exceeded = value;
+
+    uint8_t any = 0;
+    for (size_t i = 0; i < APP_CONFIG_RELE_CHANNELS; i++) {
+        any |= channels[i].attempts_exceeded;
     }
+    model_set_output_attempts_exceeded(channel->pmodel, any);
 }
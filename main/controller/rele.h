@@ -3,13 +3,22 @@
 
 
 #include <stdint.h>
+#include <stdlib.h>
 #include "model/model.h"
 
 
+void            rele_init(model_t *pmodel);
 int             rele_update(model_t *pmodel, uint8_t value);
+int             rele_update_channel(model_t *pmodel, size_t channel, uint8_t value);
 uint8_t         rele_is_on(void);
+uint8_t         rele_is_channel_on(size_t channel);
+uint16_t        rele_get_channels_on(void);
+uint8_t         rele_get_attempts(void);
+uint8_t         rele_get_channel_attempts(size_t channel);
+uint16_t        rele_get_channel_feedback_latency(size_t channel);
+uint32_t        rele_get_running_seconds(void);
+uint32_t        rele_get_channel_work_seconds(size_t channel);
 void            rele_refresh(model_t *pmodel);
-void            rele_manage(model_t *pmodel);
 
 
-#endif
\ No newline at end of file
+#endif
@@ -9,11 +9,14 @@
 #include "peripherals/digin.h"
 #include "peripherals/digout.h"
 #include "peripherals/storage.h"
+#include "peripherals/work_journal.h"
 #include "peripherals/heartbeat.h"
 #include "peripherals/rs485.h"
 #include "peripherals/hardwareprofile.h"
 #include "easyconnect_interface.h"
 #include "event_log.h"
+#include "utils/crc16.h"
+#include "utils/event_loop.h"
 
 
 static const char *TAG = "Main";
@@ -22,8 +25,12 @@ static const char *TAG = "Main";
 void app_main(void) {
     model_t model;
 
+    // Peripherals post events as soon as they are initialized, this task runs the loop
+    event_loop_init();
     system_random_init();
+    crc16_init();
     storage_init();
+    work_journal_init();
     rs485_init(EASYCONNECT_BAUDRATE);
     digin_init();
     digout_init();
@@ -36,6 +43,5 @@ void app_main(void) {
     ESP_LOGI(TAG, "Begin main loop");
     for (;;) {
         controller_manage(&model);
-        vTaskDelay(pdMS_TO_TICKS(1));
     }
 }
@@ -16,7 +16,8 @@ static const char *TAG = "Model";
 
 void model_init(model_t *pmodel) {
     (void)TAG;
-    pmodel->sem = xSemaphoreCreateMutexStatic(&pmodel->semaphore_buffer);
+    pmodel->sem      = xSemaphoreCreateMutexStatic(&pmodel->semaphore_buffer);
+    pmodel->sequence = 0;
 
     pmodel->address            = EASYCONNECT_DEFAULT_MINION_ADDRESS;
     pmodel->serial_number      = EASYCONNECT_DEFAULT_MINION_SERIAL_NUMBER;
@@ -26,25 +27,126 @@ void model_init(model_t *pmodel) {
     pmodel->output_attempts    = EASYCONNECT_DEFAULT_ACTIVATE_ATTEMPTS;
     pmodel->feedback_delay     = EASYCONNECT_DEFAULT_FEEDBACK_DELAY;
     pmodel->work_seconds       = 0;
-    pmodel->work_time_to_save  = 0;
 
     pmodel->output_attempts_exceeded = 0;
     pmodel->missing_heartbeat        = 0;
     pmodel->safety_bypass            = 0;
 
+    pmodel->boot_id         = 0;
+    pmodel->change_sequence = 0;
+    memset(pmodel->status, 0, sizeof(pmodel->status));
+
+    pmodel->changes       = 0;
+    pmodel->observers_num = 0;
+
     memset(pmodel->safety_message, 0, sizeof(pmodel->safety_message));
 }
 
 
+/*
+ *  Consistent copy of the whole model
+ */
+void model_get_snapshot(model_t *pmodel, model_t *snapshot) {
+    assert(pmodel != NULL);
+    uint32_t seq;
+    do {
+        seq = model_read_begin(pmodel);
+        memcpy(snapshot, pmodel, sizeof(model_t));
+    } while (model_read_retry(pmodel, seq));
+}
+
+
+/*
+ *  Never blocks, for ISR and timer contexts: returns 0 with a consistent copy, -1 if a write was in progress
+ */
+int model_get_snapshot_from_isr(model_t *pmodel, model_t *snapshot) {
+    assert(pmodel != NULL);
+    uint32_t seq = __atomic_load_n(&pmodel->sequence, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+        return -1;
+    }
+    memcpy(snapshot, pmodel, sizeof(model_t));
+    return model_read_retry(pmodel, seq) ? -1 : 0;
+}
+
+
+/*
+ *  Records a new value for a status field, bumping the change sequence only if it actually changed
+ */
+void model_update_status(model_t *pmodel, model_status_t field, uint32_t value) {
+    assert(pmodel != NULL);
+    assert(field < MODEL_STATUS_NUM);
+    if (model_get_status(pmodel, field) == value) {
+        // Lock-free fast path, most of the time nothing changed
+        return;
+    }
+
+    model_write_begin(pmodel);
+    if (pmodel->status[field].value != value) {
+        pmodel->change_sequence++;
+        pmodel->status[field].value    = value;
+        pmodel->status[field].sequence = pmodel->change_sequence;
+    }
+    model_write_end(pmodel);
+}
+
+
+uint32_t model_get_status(model_t *pmodel, model_status_t field) {
+    assert(pmodel != NULL);
+    assert(field < MODEL_STATUS_NUM);
+    uint32_t value;
+    uint32_t seq;
+    do {
+        seq   = model_read_begin(pmodel);
+        value = pmodel->status[field].value;
+    } while (model_read_retry(pmodel, seq));
+    return value;
+}
+
+
+/*
+ *  Collects the status fields changed after the `since` sequence number: bit n of `mask` is set when field n changed
+ *  and `values` (MODEL_STATUS_NUM elements) holds its current value. Returns the current change sequence.
+ */
+uint32_t model_get_status_changes(model_t *pmodel, uint32_t since, uint16_t *mask, uint32_t *values) {
+    assert(pmodel != NULL);
+    uint32_t sequence;
+    uint32_t seq;
+
+    do {
+        seq   = model_read_begin(pmodel);
+        *mask = 0;
+        for (model_status_t field = 0; field < MODEL_STATUS_NUM; field++) {
+            if (pmodel->status[field].sequence > since) {
+                *mask |= 1 << field;
+            }
+            values[field] = pmodel->status[field].value;
+        }
+        sequence = pmodel->change_sequence;
+    } while (model_read_retry(pmodel, seq));
+
+    return sequence;
+}
+
+
 uint16_t model_get_class(void *arg) {
     assert(arg != NULL);
     model_t *pmodel = arg;
 
-    xSemaphoreTake(pmodel->sem, portMAX_DELAY);
-    uint16_t result = (pmodel->class & CLASS_CONFIGURABLE_MASK) | (APP_CONFIG_HARDWARE_MODEL << 12);
-    xSemaphoreGive(pmodel->sem);
+    uint16_t class;
+    uint32_t seq;
+    do {
+        seq   = model_read_begin(pmodel);
+        class = pmodel->class;
+    } while (model_read_retry(pmodel, seq));
 
-    return result;
+    return (class & CLASS_CONFIGURABLE_MASK) | (APP_CONFIG_HARDWARE_MODEL << 12);
+}
+
+
+uint8_t model_is_valid_class(uint16_t class) {
+    uint16_t corrected = class & CLASS_CONFIGURABLE_MASK;
+    return valid_mode(CLASS_GET_MODE(corrected | (APP_CONFIG_HARDWARE_MODEL << 12)));
 }
 
 
@@ -53,15 +155,17 @@ int model_set_class(void *arg, uint16_t class, uint16_t *out_class) {
     model_t *pmodel = arg;
 
     uint16_t corrected = class & CLASS_CONFIGURABLE_MASK;
-    uint16_t mode      = CLASS_GET_MODE(corrected | (APP_CONFIG_HARDWARE_MODEL << 12));
 
-    if (valid_mode(mode)) {
+    if (model_is_valid_class(class)) {
         if (out_class != NULL) {
             *out_class = corrected;
         }
-        xSemaphoreTake(pmodel->sem, portMAX_DELAY);
-        pmodel->class = corrected;
-        xSemaphoreGive(pmodel->sem);
+        model_write_begin(pmodel);
+        if (pmodel->class != corrected) {
+            pmodel->class = corrected;
+            model_mark_changed(pmodel, MODEL_FIELD_CLASS);
+        }
+        model_write_end(pmodel);
         return 0;
     } else {
         return -1;
@@ -71,31 +175,41 @@ int model_set_class(void *arg, uint16_t class, uint16_t *out_class) {
 
 void model_get_safety_message(void *args, char *string) {
     model_t *pmodel = args;
-    xSemaphoreTake(pmodel->sem, portMAX_DELAY);
-    strcpy(string, pmodel->safety_message);
-    xSemaphoreGive(pmodel->sem);
+    uint32_t seq;
+    do {
+        seq = model_read_begin(pmodel);
+        memcpy(string, pmodel->safety_message, sizeof(pmodel->safety_message));
+    } while (model_read_retry(pmodel, seq));
 }
 
 
 void model_set_safety_message(model_t *pmodel, const char *string) {
-    xSemaphoreTake(pmodel->sem, portMAX_DELAY);
-    snprintf(pmodel->safety_message, sizeof(pmodel->safety_message), "%s", string);
-    xSemaphoreGive(pmodel->sem);
+    model_write_begin(pmodel);
+    if (strncmp(pmodel->safety_message, string, EASYCONNECT_MESSAGE_SIZE) != 0) {
+        snprintf(pmodel->safety_message, sizeof(pmodel->safety_message), "%s", string);
+        model_mark_changed(pmodel, MODEL_FIELD_SAFETY_MESSAGE);
+    }
+    model_write_end(pmodel);
 }
 
 
 void model_get_feedback_message(void *args, char *string) {
     model_t *pmodel = args;
-    xSemaphoreTake(pmodel->sem, portMAX_DELAY);
-    strcpy(string, pmodel->feedback_message);
-    xSemaphoreGive(pmodel->sem);
+    uint32_t seq;
+    do {
+        seq = model_read_begin(pmodel);
+        memcpy(string, pmodel->feedback_message, sizeof(pmodel->feedback_message));
+    } while (model_read_retry(pmodel, seq));
 }
 
 
 void model_set_feedback_message(model_t *pmodel, const char *string) {
-    xSemaphoreTake(pmodel->sem, portMAX_DELAY);
-    snprintf(pmodel->feedback_message, sizeof(pmodel->feedback_message), "%s", string);
-    xSemaphoreGive(pmodel->sem);
+    model_write_begin(pmodel);
+    if (strncmp(pmodel->feedback_message, string, EASYCONNECT_MESSAGE_SIZE) != 0) {
+        snprintf(pmodel->feedback_message, sizeof(pmodel->feedback_message), "%s", string);
+        model_mark_changed(pmodel, MODEL_FIELD_FEEDBACK_MESSAGE);
+    }
+    model_write_end(pmodel);
 }
 
 
@@ -114,28 +228,24 @@ const char *model_default_safety_message(model_t *pmodel) {
 
 void model_increase_work_seconds(model_t *pmodel, uint32_t seconds) {
     if (seconds > 0) {
-        xSemaphoreTake(pmodel->sem, portMAX_DELAY);
+        model_write_begin(pmodel);
         pmodel->work_seconds += seconds;
-        pmodel->work_time_to_save = 1;
-        xSemaphoreGive(pmodel->sem);
+        model_mark_changed(pmodel, MODEL_FIELD_WORK_SECONDS);
+        model_write_end(pmodel);
     }
 }
 
 
 void model_reset_work_seconds(model_t *pmodel) {
-    xSemaphoreTake(pmodel->sem, portMAX_DELAY);
-    pmodel->work_seconds      = 0;
-    pmodel->work_time_to_save = 1;
-    xSemaphoreGive(pmodel->sem);
+    model_write_begin(pmodel);
+    pmodel->work_seconds = 0;
+    model_mark_changed(pmodel, MODEL_FIELD_WORK_SECONDS);
+    model_write_end(pmodel);
 }
 
 
 uint16_t model_get_work_hours(model_t *pmodel) {
-    uint16_t result = 0;
-    xSemaphoreTake(pmodel->sem, portMAX_DELAY);
-    result = pmodel->work_seconds / (60UL * 60UL);
-    xSemaphoreGive(pmodel->sem);
-    return result;
+    return model_get_work_seconds(pmodel) / (60UL * 60UL);
 }
 
 
@@ -144,6 +254,53 @@ uint8_t model_is_safety_mode(model_t *model) {
 }
 
 
+/*
+ *  Registers an observer for the fields in `mask` (MODEL_CHANGED bits); meant for initialization only, as the
+ *  registry itself is not protected. Returns 0 on success, -1 if there is no room left.
+ */
+int model_subscribe(model_t *pmodel, uint32_t mask, model_observer_t observer, void *arg) {
+    assert(pmodel != NULL);
+    assert(observer != NULL);
+
+    if (pmodel->observers_num >= MODEL_MAX_OBSERVERS) {
+        ESP_LOGE(TAG, "No room for another observer");
+        return -1;
+    }
+
+    pmodel->observers[pmodel->observers_num].mask     = mask;
+    pmodel->observers[pmodel->observers_num].observer = observer;
+    pmodel->observers[pmodel->observers_num].arg      = arg;
+    pmodel->observers_num++;
+    return 0;
+}
+
+
+/*
+ *  Returns and clears the fields changed since the previous call
+ */
+uint32_t model_take_changes(model_t *pmodel) {
+    assert(pmodel != NULL);
+    return __atomic_exchange_n(&pmodel->changes, 0, __ATOMIC_ACQ_REL);
+}
+
+
+/*
+ *  Runs, in the caller's context, every observer subscribed to a field changed since the previous notification
+ */
+void model_notify(model_t *pmodel) {
+    uint32_t changes = model_take_changes(pmodel);
+    if (changes == 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < pmodel->observers_num; i++) {
+        if (pmodel->observers[i].mask & changes) {
+            pmodel->observers[i].observer(pmodel->observers[i].arg, pmodel->observers[i].mask & changes);
+        }
+    }
+}
+
+
 static uint8_t valid_mode(uint16_t mode) {
     switch (mode) {
         case DEVICE_MODE_LIGHT:
@@ -1,6 +1,7 @@
 #ifndef MODEL_H_INCLUDED
 #define MODEL_H_INCLUDED
 
+#include <stddef.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "easyconnect_interface.h"
@@ -17,6 +18,9 @@
 #define EASYCONNECT_PARAMETER_MAX_ACTIVATION_ATTEMPTS 8
 #define EASYCONNECT_PARAMETER_MAX_FEEDBACK_DELAY      8
 
+#define MODEL_ALARM_SAFETY            0x01
+#define MODEL_ALARM_ATTEMPTS_EXCEEDED 0x02
+
 
 #define GETTER_UNSAFE(name, field)                                                                                     \
     static inline __attribute__((always_inline)) typeof(((model_t *)0)->field) model_get_##name(model_t *pmodel) {     \
@@ -36,45 +40,104 @@
     static inline __attribute__((always_inline)) typeof(((model_t *)0)->field) model_get_##name(type *arg) {           \
         model_t *pmodel = arg;                                                                                         \
         assert(pmodel != NULL);                                                                                        \
-        xSemaphoreTake(pmodel->sem, portMAX_DELAY);                                                                    \
-        typeof(((model_t *)0)->field) res = pmodel->field;                                                             \
-        xSemaphoreGive(pmodel->sem);                                                                                   \
+        typeof(((model_t *)0)->field) res;                                                                             \
+        uint32_t                      seq;                                                                             \
+        do {                                                                                                           \
+            seq = model_read_begin(pmodel);                                                                            \
+            res = pmodel->field;                                                                                       \
+        } while (model_read_retry(pmodel, seq));                                                                       \
         return res;                                                                                                    \
     }
 
 
-#define SETTER(type, name, field)                                                                                      \
+#define SETTER(type, name, field, id)                                                                                  \
     static inline                                                                                                      \
         __attribute__((always_inline)) void model_set_##name(type *arg, typeof(((model_t *)0)->field) value) {         \
         model_t *pmodel = arg;                                                                                         \
         assert(pmodel != NULL);                                                                                        \
-        xSemaphoreTake(pmodel->sem, portMAX_DELAY);                                                                    \
-        pmodel->field = value;                                                                                         \
-        xSemaphoreGive(pmodel->sem);                                                                                   \
+        model_write_begin(pmodel);                                                                                     \
+        if (pmodel->field != value) {                                                                                  \
+            pmodel->field = value;                                                                                     \
+            model_mark_changed(pmodel, id);                                                                            \
+        }                                                                                                              \
+        model_write_end(pmodel);                                                                                       \
     }
 
-#define GETTER_GENERIC(name, field) GETTER(void, name, field)
-#define SETTER_GENERIC(name, field) SETTER(void, name, field)
+#define GETTER_GENERIC(name, field)     GETTER(void, name, field)
+#define SETTER_GENERIC(name, field, id) SETTER(void, name, field, id)
 
-#define GETTER_MODEL(name, field) GETTER(model_t, name, field)
-#define SETTER_MODEL(name, field) SETTER(model_t, name, field)
+#define GETTER_MODEL(name, field)     GETTER(model_t, name, field)
+#define SETTER_MODEL(name, field, id) SETTER(model_t, name, field, id)
 
-#define GETTERNSETTER_GENERIC(name, field)                                                                             \
+#define GETTERNSETTER_GENERIC(name, field, id)                                                                         \
     GETTER_GENERIC(name, field)                                                                                        \
-    SETTER_GENERIC(name, field)
+    SETTER_GENERIC(name, field, id)
 
 #define GETTERNSETTER_UNSAFE(name, field)                                                                              \
     GETTER_UNSAFE(name, field)                                                                                         \
     SETTER_UNSAFE(name, field)
 
-#define GETTERNSETTER(name, field)                                                                                     \
+#define GETTERNSETTER(name, field, id)                                                                                 \
     GETTER_MODEL(name, field)                                                                                          \
-    SETTER_MODEL(name, field)
-
-
+    SETTER_MODEL(name, field, id)
+
+
+/*
+ *  Fields whose changes are reported to the observers, as bit positions of the change mask
+ */
+typedef enum {
+    MODEL_FIELD_ADDRESS = 0,
+    MODEL_FIELD_CLASS,
+    MODEL_FIELD_SERIAL_NUMBER,
+    MODEL_FIELD_SAFETY_MESSAGE,
+    MODEL_FIELD_FEEDBACK_MESSAGE,
+    MODEL_FIELD_FEEDBACK_ENABLED,
+    MODEL_FIELD_FEEDBACK_DIRECTION,
+    MODEL_FIELD_OUTPUT_ATTEMPTS,
+    MODEL_FIELD_FEEDBACK_DELAY,
+    MODEL_FIELD_MISSING_HEARTBEAT,
+    MODEL_FIELD_WORK_SECONDS,
+    MODEL_FIELD_OUTPUT_ATTEMPTS_EXCEEDED,
+    MODEL_FIELD_SAFETY_BYPASS,
+    MODEL_FIELD_BOOT_ID,
+    MODEL_FIELD_NUM,
+} model_field_t;
+
+#define MODEL_CHANGED(field) (1UL << (field))
+
+#define MODEL_MAX_OBSERVERS 4
+
+
+/*
+ *  Called with the subscribed fields that changed since the previous notification
+ */
+typedef void (*model_observer_t)(void *arg, uint32_t changes);
+
+
+/*
+ *  Status fields mirrored by the controller, each one tagged with the change sequence of its last update
+ */
+typedef enum {
+    MODEL_STATUS_RELE_STATE = 0,
+    MODEL_STATUS_ALARMS,
+    MODEL_STATUS_INPUTS,
+    MODEL_STATUS_OUTPUTS,
+    MODEL_STATUS_HEARTBEAT,
+    MODEL_STATUS_ATTEMPTS,
+    MODEL_STATUS_WORK_SECONDS,
+    MODEL_STATUS_NUM,
+} model_status_t;
+
+
+/*
+ *  Readers never lock: every write is framed by two increments of `sequence` (odd while the write is in progress)
+ *  and a reader retries if the sequence was odd or changed while it was copying.
+ *  Writers still serialize among themselves through the mutex.
+ */
 typedef struct {
     StaticSemaphore_t semaphore_buffer;
     SemaphoreHandle_t sem;
+    uint32_t          sequence;
 
     uint16_t address;
     uint16_t class;
@@ -88,16 +151,79 @@ typedef struct {
     uint8_t feedback_delay;
     uint8_t missing_heartbeat;
 
-    uint8_t  work_time_to_save;
     uint32_t work_seconds;
 
     uint8_t output_attempts_exceeded;
     uint8_t safety_bypass;
+
+    // Random at every boot, lets the master notice that the change sequence restarted
+    uint16_t boot_id;
+    // Monotonically increasing, bumped on every status change
+    uint32_t change_sequence;
+    struct {
+        uint32_t value;
+        uint32_t sequence;
+    } status[MODEL_STATUS_NUM];
+
+    // MODEL_CHANGED bits of the fields modified since the last model_notify
+    uint32_t changes;
+    struct {
+        uint32_t         mask;
+        model_observer_t observer;
+        void            *arg;
+    } observers[MODEL_MAX_OBSERVERS];
+    size_t observers_num;
 } model_t;
 
 
+static inline __attribute__((always_inline)) uint32_t model_read_begin(model_t *pmodel) {
+    uint32_t seq = __atomic_load_n(&pmodel->sequence, __ATOMIC_ACQUIRE);
+    while (seq & 1) {
+        // A write is in progress and its task may have been preempted by ours: spinning could never end,
+        // wait for it on the mutex instead (priority inheritance lets it complete)
+        xSemaphoreTake(pmodel->sem, portMAX_DELAY);
+        xSemaphoreGive(pmodel->sem);
+        seq = __atomic_load_n(&pmodel->sequence, __ATOMIC_ACQUIRE);
+    }
+    return seq;
+}
+
+
+static inline __attribute__((always_inline)) int model_read_retry(model_t *pmodel, uint32_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&pmodel->sequence, __ATOMIC_RELAXED) != seq;
+}
+
+
+static inline __attribute__((always_inline)) void model_write_begin(model_t *pmodel) {
+    xSemaphoreTake(pmodel->sem, portMAX_DELAY);
+    __atomic_store_n(&pmodel->sequence, pmodel->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+static inline __attribute__((always_inline)) void model_write_end(model_t *pmodel) {
+    __atomic_store_n(&pmodel->sequence, pmodel->sequence + 1, __ATOMIC_RELEASE);
+    xSemaphoreGive(pmodel->sem);
+}
+
+
+/*
+ *  To be called by writers, between model_write_begin and model_write_end
+ */
+static inline __attribute__((always_inline)) void model_mark_changed(model_t *pmodel, model_field_t field) {
+    __atomic_fetch_or(&pmodel->changes, MODEL_CHANGED(field), __ATOMIC_RELAXED);
+}
+
+
 void     model_init(model_t *model);
+void     model_get_snapshot(model_t *pmodel, model_t *snapshot);
+int      model_get_snapshot_from_isr(model_t *pmodel, model_t *snapshot);
+void     model_update_status(model_t *pmodel, model_status_t field, uint32_t value);
+uint32_t model_get_status(model_t *pmodel, model_status_t field);
+uint32_t model_get_status_changes(model_t *pmodel, uint32_t since, uint16_t *mask, uint32_t *values);
 uint16_t model_get_class(void *arg);
+uint8_t  model_is_valid_class(uint16_t class);
 int      model_set_class(void *arg, uint16_t class, uint16_t *out_class);
 void     model_get_safety_message(void *args, char *string);
 void     model_set_safety_message(model_t *pmodel, const char *string);
@@ -107,18 +233,20 @@ void     model_increase_work_seconds(model_t *pmodel, uint32_t seconds);
 void     model_reset_work_seconds(model_t *pmodel);
 uint16_t model_get_work_hours(model_t *pmodel);
 uint8_t  model_is_safety_mode(model_t *model);
-
-GETTERNSETTER_GENERIC(address, address);
-GETTERNSETTER_GENERIC(serial_number, serial_number);
-GETTERNSETTER_GENERIC(missing_heartbeat, missing_heartbeat);
-GETTERNSETTER_GENERIC(work_seconds, work_seconds);
-GETTERNSETTER(feedback_enabled, feedback_enabled);
-GETTERNSETTER(feedback_direction, feedback_direction);
-GETTERNSETTER(output_attempts, output_attempts);
-GETTERNSETTER(output_attempts_exceeded, output_attempts_exceeded);
-GETTERNSETTER(feedback_delay, feedback_delay);
-GETTERNSETTER(work_time_to_save, work_time_to_save);
-GETTERNSETTER(safety_bypass, safety_bypass);
-
+int      model_subscribe(model_t *pmodel, uint32_t mask, model_observer_t observer, void *arg);
+uint32_t model_take_changes(model_t *pmodel);
+void     model_notify(model_t *pmodel);
+
+GETTERNSETTER_GENERIC(address, address, MODEL_FIELD_ADDRESS);
+GETTERNSETTER_GENERIC(serial_number, serial_number, MODEL_FIELD_SERIAL_NUMBER);
+GETTERNSETTER_GENERIC(missing_heartbeat, missing_heartbeat, MODEL_FIELD_MISSING_HEARTBEAT);
+GETTERNSETTER_GENERIC(work_seconds, work_seconds, MODEL_FIELD_WORK_SECONDS);
+GETTERNSETTER(feedback_enabled, feedback_enabled, MODEL_FIELD_FEEDBACK_ENABLED);
+GETTERNSETTER(feedback_direction, feedback_direction, MODEL_FIELD_FEEDBACK_DIRECTION);
+GETTERNSETTER(output_attempts, output_attempts, MODEL_FIELD_OUTPUT_ATTEMPTS);
+GETTERNSETTER(output_attempts_exceeded, output_attempts_exceeded, MODEL_FIELD_OUTPUT_ATTEMPTS_EXCEEDED);
+GETTERNSETTER(feedback_delay, feedback_delay, MODEL_FIELD_FEEDBACK_DELAY);
+GETTERNSETTER(safety_bypass, safety_bypass, MODEL_FIELD_SAFETY_BYPASS);
+GETTERNSETTER(boot_id, boot_id, MODEL_FIELD_BOOT_ID);
 
 #endif
@@ -1,89 +1,261 @@
 #include "hal/gpio_types.h"
 #include "peripherals/hardwareprofile.h"
 #include "peripherals/digin.h"
+#include <assert.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/queue.h"
 #include "driver/gpio.h"
-#include "gel/debounce/debounce.h"
-#include "freertos/semphr.h"
+#include "esp_timer.h"
 #include "esp_log.h"
-#include "freertos/timers.h"
-#include "freertos/event_groups.h"
+#include "utils/event_loop.h"
+#include "config/app_config.h"
 #include "digin.h"
 
 
-#define EVENT_NEW_INPUT 0x01
+#define INPUTS_NUM (1 + APP_CONFIG_RELE_CHANNELS)
+// Power of two, so that the free running indexes wrap around cleanly
+#define RING_SIZE 32
 
 
-static debounce_filter_t  filter;
-static SemaphoreHandle_t  sem;
-static EventGroupHandle_t events;
+/*
+ *  Edge captured by the interrupt: level after the transition and when it happened
+ */
+typedef struct {
+    int64_t timestamp;
+    uint8_t input;
+    uint8_t level;
+} edge_t;
 
 
-static void periodic_read(TimerHandle_t timer);
+static void     digin_task(void *args);
+static void     edge_isr(void *arg);
+static void     drain_edges(void);
+static uint32_t debounce(int64_t now);
+static uint8_t  sample(size_t input);
+
+
+static const char *TAG = "Digin";
+
+// Edge times are 64 bit, read and written in one piece
+static portMUX_TYPE edge_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Indexed like digin_t: the safety input, then the feedback of every relay channel
+static gpio_num_t gpios[INPUTS_NUM] = {0};
+
+static const gpio_num_t feedbacks[] = HAP_RELE_FEEDBACKS;
+
+_Static_assert(sizeof(feedbacks) / sizeof(feedbacks[0]) == APP_CONFIG_RELE_CHANNELS,
+               "One feedback input for each relay channel");
+_Static_assert((RING_SIZE & (RING_SIZE - 1)) == 0, "The ring size must be a power of two");
+
+/*
+ *  Single producer, single consumer ring: only the interrupt moves `head` and only the input task moves `tail`,
+ *  so neither side needs a lock
+ */
+static struct {
+    edge_t   edges[RING_SIZE];
+    uint32_t head;
+    uint32_t tail;
+    uint32_t overruns;
+} ring = {0};
+
+/*
+ *  Debounce state, owned by the input task; `stable` is also read by everyone else
+ */
+static struct {
+    TaskHandle_t task;
+    uint32_t     raw;
+    uint32_t     stable;
+    uint32_t     overruns;
+    int64_t      last_edge[INPUTS_NUM];
+    // Edge that brought each input to its current stable level
+    int64_t stable_edge[INPUTS_NUM];
+} inputs = {0};
 
 
 void digin_init(void) {
+    gpios[DIGIN_SAFETY] = HAP_SAFETY;
+    for (size_t i = 0; i < APP_CONFIG_RELE_CHANNELS; i++) {
+        gpios[DIGIN_FEEDBACK(i)] = feedbacks[i];
+    }
+
     gpio_config_t io_conf = {};
-    io_conf.intr_type     = GPIO_INTR_DISABLE;
-    io_conf.pin_bit_mask  = BIT64(HAP_SAFETY) | BIT64(HAP_SIGNAL);
+    io_conf.intr_type     = GPIO_INTR_ANYEDGE;
+    io_conf.pin_bit_mask  = 0;
     io_conf.mode          = GPIO_MODE_INPUT;
     io_conf.pull_down_en  = 0;
     io_conf.pull_up_en    = 0;
+    for (size_t i = 0; i < INPUTS_NUM; i++) {
+        io_conf.pin_bit_mask |= BIT64(gpios[i]);
+    }
     gpio_config(&io_conf);
 
-    static StaticEventGroup_t event_group_buffer;
-    events = xEventGroupCreateStatic(&event_group_buffer);
+    // The levels at boot are taken as already stable
+    int64_t now = esp_timer_get_time();
+    for (size_t i = 0; i < INPUTS_NUM; i++) {
+        inputs.raw |= sample(i) << i;
+        inputs.last_edge[i]   = now;
+        inputs.stable_edge[i] = now;
+    }
+    inputs.stable = inputs.raw;
 
-    debounce_filter_init(&filter);
-    static StaticSemaphore_t semaphore_buffer;
-    sem = xSemaphoreCreateMutexStatic(&semaphore_buffer);
+    static uint8_t      stack_buffer[APP_CONFIG_BASE_TASK_STACK_SIZE * 4];
+    static StaticTask_t task_buffer;
+    inputs.task = xTaskCreateStatic(digin_task, "Digin", sizeof(stack_buffer), NULL, APP_CONFIG_DIGIN_TASK_PRIORITY,
+                                    stack_buffer, &task_buffer);
 
-    static StaticTimer_t timer_buffer;
-    TimerHandle_t        timer =
-        xTimerCreateStatic("timerInput", pdMS_TO_TICKS(10), pdTRUE, NULL, periodic_read, &timer_buffer);
-    xTimerStart(timer, portMAX_DELAY);
+    // Not an IRAM interrupt: an edge during a flash write is timestamped as soon as the write ends
+    ESP_ERROR_CHECK(gpio_install_isr_service(0));
+    for (size_t i = 0; i < INPUTS_NUM; i++) {
+        ESP_ERROR_CHECK(gpio_isr_handler_add(gpios[i], edge_isr, (void *)(uintptr_t)i));
+    }
+
+    ESP_LOGI(TAG, "Inputs initialized (0x%X)", (unsigned int)inputs.stable);
 }
 
 
 int digin_get(digin_t digin) {
-    int res = 0;
-    xSemaphoreTake(sem, portMAX_DELAY);
-    res = debounce_read(&filter, digin);
-    xSemaphoreGive(sem);
-    return res;
+    return (__atomic_load_n(&inputs.stable, __ATOMIC_RELAXED) >> digin) & 0x01;
 }
 
 
+/*
+ *  Samples every input right away, as if all of them just had an edge; meant for the input task only.
+ *  Returns 1 if some level differs from the last one seen.
+ */
 int digin_take_reading(void) {
-    unsigned int input = 0;
-    input |= !gpio_get_level(HAP_SAFETY);
-    input |= (!gpio_get_level(HAP_SIGNAL)) << 1;
-    return debounce_filter(&filter, input, 5);
+    int64_t  now = esp_timer_get_time();
+    uint32_t raw = 0;
+
+    for (size_t i = 0; i < INPUTS_NUM; i++) {
+        raw |= sample(i) << i;
+        inputs.last_edge[i] = now;
+    }
+
+    int changed = raw != inputs.raw;
+    inputs.raw  = raw;
+    return changed;
 }
 
 
 unsigned int digin_get_inputs(void) {
-    return debounce_value(&filter);
+    return __atomic_load_n(&inputs.stable, __ATOMIC_RELAXED);
+}
+
+
+/*
+ *  Time (esp_timer microseconds) of the edge that brought the input to its current debounced level
+ */
+int64_t digin_get_edge_time(digin_t digin) {
+    assert(digin < INPUTS_NUM);
+    int64_t timestamp;
+    portENTER_CRITICAL(&edge_lock);
+    timestamp = inputs.stable_edge[digin];
+    portEXIT_CRITICAL(&edge_lock);
+    return timestamp;
+}
+
+
+static void digin_task(void *args) {
+    (void)args;
+    TickType_t timeout = portMAX_DELAY;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, timeout);
+        drain_edges();
+
+        uint32_t remaining_us = debounce(esp_timer_get_time());
+        // Sleep until the next input settles, or the next edge
+        timeout = remaining_us > 0 ? pdMS_TO_TICKS((remaining_us + 999) / 1000) + 1 : portMAX_DELAY;
+    }
+
+    vTaskDelete(NULL);
 }
 
 
-uint8_t digin_is_value_ready(void) {
-    uint8_t res = xEventGroupGetBits(events) & EVENT_NEW_INPUT;
-    xEventGroupClearBits(events, EVENT_NEW_INPUT);
-    return res > 0;
+static void edge_isr(void *arg) {
+    size_t   input = (size_t)(uintptr_t)arg;
+    uint32_t head  = ring.head;
+
+    if (head - __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE) >= RING_SIZE) {
+        // The task fell behind, it will sample the inputs again
+        ring.overruns++;
+    } else {
+        edge_t *edge    = &ring.edges[head & (RING_SIZE - 1)];
+        edge->timestamp = esp_timer_get_time();
+        edge->input     = input;
+        edge->level     = sample(input);
+        __atomic_store_n(&ring.head, head + 1, __ATOMIC_RELEASE);
+    }
+
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(inputs.task, &woken);
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
 }
 
 
-static void periodic_read(TimerHandle_t timer) {
-    (void)timer;
-    xSemaphoreTake(sem, portMAX_DELAY);
-    if (digin_take_reading()) {
-        xEventGroupSetBits(events, EVENT_NEW_INPUT);
+static void drain_edges(void) {
+    uint32_t head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+
+    while (ring.tail != head) {
+        const edge_t *edge = &ring.edges[ring.tail & (RING_SIZE - 1)];
+        // Even an edge that leaves the level unchanged means the input bounced in the meantime
+        inputs.last_edge[edge->input] = edge->timestamp;
+        inputs.raw = (inputs.raw & ~(1UL << edge->input)) | ((uint32_t)edge->level << edge->input);
+        __atomic_store_n(&ring.tail, ring.tail + 1, __ATOMIC_RELEASE);
     }
-    xSemaphoreGive(sem);
+
+    uint32_t overruns = __atomic_load_n(&ring.overruns, __ATOMIC_RELAXED);
+    if (overruns != inputs.overruns) {
+        ESP_LOGW(TAG, "Input edges lost");
+        inputs.overruns = overruns;
+        digin_take_reading();
+    }
+}
+
+
+/*
+ *  An input takes its new level once it has not moved for APP_CONFIG_DIGIN_DEBOUNCE_US.
+ *  Returns the microseconds until the next input could settle, 0 if none is pending.
+ */
+static uint32_t debounce(int64_t now) {
+    uint32_t stable    = inputs.stable;
+    uint32_t remaining = 0;
+
+    for (size_t i = 0; i < INPUTS_NUM; i++) {
+        uint32_t mask = 1UL << i;
+        if ((inputs.raw & mask) == (stable & mask)) {
+            continue;
+        }
+
+        int64_t elapsed = now - inputs.last_edge[i];
+        if (elapsed >= APP_CONFIG_DIGIN_DEBOUNCE_US) {
+            stable ^= mask;
+            portENTER_CRITICAL(&edge_lock);
+            inputs.stable_edge[i] = inputs.last_edge[i];
+            portEXIT_CRITICAL(&edge_lock);
+        } else if (remaining == 0 || APP_CONFIG_DIGIN_DEBOUNCE_US - elapsed < remaining) {
+            remaining = (uint32_t)(APP_CONFIG_DIGIN_DEBOUNCE_US - elapsed);
+        }
+    }
+
+    if (stable != inputs.stable) {
+        __atomic_store_n(&inputs.stable, stable, __ATOMIC_RELAXED);
+        event_loop_post(EVENT_LOOP_INPUT);
+    }
+
+    return remaining;
+}
+
+
+/*
+ *  Inputs are active low
+ */
+static uint8_t sample(size_t input) {
+    return !gpio_get_level(gpios[input]);
 }
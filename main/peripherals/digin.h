@@ -10,10 +10,13 @@ typedef enum {
     DIGIN_SIGNAL,
 } digin_t;
 
+// Feedback inputs of the relay channels, the first one is the signal input
+#define DIGIN_FEEDBACK(channel) ((digin_t)(DIGIN_SIGNAL + (channel)))
+
 void         digin_init(void);
 int          digin_get(digin_t digin);
 int          digin_take_reading(void);
 unsigned int digin_get_inputs(void);
-uint8_t      digin_is_value_ready(void);
+int64_t      digin_get_edge_time(digin_t digin);
 
 #endif
\ No newline at end of file
@@ -8,10 +8,15 @@
 #include "freertos/queue.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
+#include "config/app_config.h"
 
 
 static const char *TAG = "Digout";
 
+static const gpio_num_t outputs[] = HAP_RELE_OUTPUTS;
+
+_Static_assert(sizeof(outputs) / sizeof(outputs[0]) == APP_CONFIG_RELE_CHANNELS, "One output for each relay channel");
+
 
 void digout_init(void) {
     (void)TAG;
@@ -19,22 +24,33 @@ void digout_init(void) {
     gpio_config_t io_conf = {};
     io_conf.intr_type     = GPIO_INTR_DISABLE;
     io_conf.mode          = GPIO_MODE_INPUT_OUTPUT;
-    io_conf.pin_bit_mask  = BIT64(HAP_REL) ;
+    io_conf.pin_bit_mask  = 0;
     io_conf.pull_down_en  = 0;
     io_conf.pull_up_en    = 0;
+    for (size_t i = 0; i < APP_CONFIG_RELE_CHANNELS; i++) {
+        io_conf.pin_bit_mask |= BIT64(outputs[i]);
+    }
     gpio_config(&io_conf);
 
-    gpio_set_level(HAP_REL, 0);
+    for (size_t i = 0; i < APP_CONFIG_RELE_CHANNELS; i++) {
+        gpio_set_level(outputs[i], 0);
+    }
 }
 
 
 void digout_update(digout_t digout, uint8_t val) {
-    val               = val > 0;
-    gpio_num_t gpio[] = {HAP_REL};
-    gpio_set_level(gpio[digout], val);
+    val = val > 0;
+    gpio_set_level(outputs[digout], val);
 }
 
 
+/*
+ *  Level of the outputs, bit n for relay channel n
+ */
 uint8_t digout_get(void) {
-    return gpio_get_level(HAP_REL);
+    uint8_t res = 0;
+    for (size_t i = 0; i < APP_CONFIG_RELE_CHANNELS; i++) {
+        res |= gpio_get_level(outputs[i]) << i;
+    }
+    return res;
 }
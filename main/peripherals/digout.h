@@ -9,6 +9,9 @@ typedef enum {
     DIGOUT_RELE = 0,
 } digout_t;
 
+// Outputs of the relay channels follow the first one
+#define DIGOUT_RELE_CHANNEL(channel) ((digout_t)(DIGOUT_RELE + (channel)))
+
 
 void    digout_init(void);
 void    digout_update(digout_t digout, uint8_t val);
@@ -5,6 +5,12 @@
 #define HAP_SIGNAL GPIO_NUM_6
 #define HAP_REL    GPIO_NUM_3
 
+/*
+ *  Output and feedback input of every relay channel, in channel order (APP_CONFIG_RELE_CHANNELS entries)
+ */
+#define HAP_RELE_OUTPUTS   {HAP_REL}
+#define HAP_RELE_FEEDBACKS {HAP_SIGNAL}
+
 #define MB_UART_TXD GPIO_NUM_21
 #define MB_UART_RXD GPIO_NUM_20
 #define MB_DERE     GPIO_NUM_7
@@ -0,0 +1,75 @@
+#include <stddef.h>
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "utils/crc16.h"
+#include "retained.h"
+
+
+#define RETAINED_MAGIC 0x52544E43
+
+
+typedef struct {
+    uint32_t            magic;
+    retained_counters_t counters;
+    // Modbus CRC of the previous fields
+    uint16_t crc;
+} retained_t;
+
+
+static uint16_t retained_crc(const retained_t *retained);
+static uint8_t  warm_reset(void);
+
+
+static const char *TAG = "Retained";
+
+/*
+ *  RTC RAM is left untouched by the startup code: after a power cycle it holds garbage, after a warm reset
+ *  it still holds the last stored counters
+ */
+static RTC_NOINIT_ATTR retained_t retained;
+
+
+/*
+ *  Returns 0 if the counters survived a warm reset, -1 otherwise
+ */
+int retained_load(retained_counters_t *counters) {
+    if (!warm_reset()) {
+        return -1;
+    }
+    if (retained.magic != RETAINED_MAGIC || retained.crc != retained_crc(&retained)) {
+        ESP_LOGW(TAG, "Retained counters are not valid");
+        return -1;
+    }
+
+    *counters = retained.counters;
+    return 0;
+}
+
+
+void retained_store(const retained_counters_t *counters) {
+    retained.magic    = RETAINED_MAGIC;
+    retained.counters = *counters;
+    retained.crc      = retained_crc(&retained);
+}
+
+
+static uint16_t retained_crc(const retained_t *retained) {
+    return crc16_modbus((const uint8_t *)retained, offsetof(retained_t, crc));
+}
+
+
+static uint8_t warm_reset(void) {
+    switch (esp_reset_reason()) {
+        case ESP_RST_SW:
+        case ESP_RST_PANIC:
+        case ESP_RST_INT_WDT:
+        case ESP_RST_TASK_WDT:
+        case ESP_RST_WDT:
+            return 1;
+
+        default:
+            return 0;
+    }
+}
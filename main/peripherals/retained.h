@@ -0,0 +1,21 @@
+#ifndef RETAINED_H_INCLUDED
+#define RETAINED_H_INCLUDED
+
+
+#include <stdint.h>
+
+
+/*
+ *  Runtime counters that survive a software or watchdog reset
+ */
+typedef struct {
+    uint32_t work_seconds;
+    uint8_t  output_attempts_exceeded;
+} retained_counters_t;
+
+
+int  retained_load(retained_counters_t *counters);
+void retained_store(const retained_counters_t *counters);
+
+
+#endif
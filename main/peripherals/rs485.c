@@ -1,13 +1,25 @@
 #include <driver/gpio.h>
 #include <driver/uart.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
 #include "hardwareprofile.h"
+#include "rs485.h"
 
 
 #define MB_PORTNUM 1
 // Timeout threshold for UART = number of symbols (~10 tics) with unchanged
 // state on receive pin
-#define ECHO_READ_TOUT (3)     // 3.5T * 8 = 28 ticks, TOUT=3 -> ~24..33 ticks
-#define MODBUS_TIMEOUT 10
+#define ECHO_READ_TOUT    (3)     // 3.5T * 8 = 28 ticks, TOUT=3 -> ~24..33 ticks
+#define MODBUS_TIMEOUT    10
+#define EVENT_QUEUE_SIZE  16
+#define RX_BUFFER_SIZE    256
+#define TX_BUFFER_SIZE    256
+
+
+static const char   *TAG = "RS485";
+static QueueHandle_t uart_queue;
+static uint32_t      current_baud_rate = 0;
 
 
 void rs485_init(int baud_rate) {
@@ -24,9 +36,66 @@ void rs485_init(int baud_rate) {
     ESP_ERROR_CHECK(uart_param_config(MB_PORTNUM, &uart_config));
 
     ESP_ERROR_CHECK(uart_set_pin(MB_PORTNUM, MB_UART_TXD, MB_UART_RXD, MB_DERE, -1));
-    ESP_ERROR_CHECK(uart_driver_install(MB_PORTNUM, 256, 256, 10, NULL, 0));
+    ESP_ERROR_CHECK(uart_driver_install(MB_PORTNUM, RX_BUFFER_SIZE, TX_BUFFER_SIZE, EVENT_QUEUE_SIZE, &uart_queue, 0));
     ESP_ERROR_CHECK(uart_set_mode(MB_PORTNUM, UART_MODE_RS485_HALF_DUPLEX));
     ESP_ERROR_CHECK(uart_set_rx_timeout(MB_PORTNUM, ECHO_READ_TOUT));
+    current_baud_rate = baud_rate;
+}
+
+
+void rs485_set_baudrate(uint32_t baud_rate) {
+    ESP_ERROR_CHECK(uart_set_baudrate(MB_PORTNUM, baud_rate));
+    current_baud_rate = baud_rate;
+}
+
+
+uint32_t rs485_get_baudrate(void) {
+    return current_baud_rate;
+}
+
+
+int rs485_wait_event(rs485_event_t *event, unsigned long timeout_ms) {
+    uart_event_t uart_event = {0};
+
+    if (xQueueReceive(uart_queue, &uart_event, timeout_ms == RS485_WAIT_FOREVER ? portMAX_DELAY
+                                                                                  : pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+        return -1;
+    }
+
+    switch (uart_event.type) {
+        case UART_DATA:
+            event->code      = RS485_EVENT_DATA;
+            event->len       = uart_event.size;
+            event->frame_end = uart_event.timeout_flag;
+            break;
+
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+            // Whatever is in the buffer is now a truncated frame; drop it and start over
+            ESP_LOGW(TAG, "RX overflow (%i)", uart_event.type);
+            uart_flush_input(MB_PORTNUM);
+            xQueueReset(uart_queue);
+            event->code      = RS485_EVENT_OVERRUN;
+            event->len       = 0;
+            event->frame_end = 0;
+            break;
+
+        case UART_FRAME_ERR:
+        case UART_PARITY_ERR:
+        case UART_BREAK:
+            event->code      = RS485_EVENT_ERROR;
+            event->len       = 0;
+            event->frame_end = 0;
+            break;
+
+        default:
+            event->code      = RS485_EVENT_NONE;
+            event->len       = 0;
+            event->frame_end = 0;
+            break;
+    }
+
+    return 0;
 }
 
 
@@ -35,11 +104,21 @@ int rs485_read(uint8_t *buffer, size_t len) {
 }
 
 
+int rs485_read_available(uint8_t *buffer, size_t len) {
+    return uart_read_bytes(MB_PORTNUM, buffer, len, 0);
+}
+
+
 int rs485_write(uint8_t *buffer, size_t len) {
     return uart_write_bytes(MB_PORTNUM, buffer, len);
 }
 
 
+void rs485_wait_tx_done(void) {
+    uart_wait_tx_done(MB_PORTNUM, portMAX_DELAY);
+}
+
+
 void rs485_flush(void) {
     uart_flush_input(MB_PORTNUM);
 }
@@ -6,10 +6,36 @@
 #include <stdlib.h>
 
 
-void rs485_init(int baud_rate);
-int  rs485_read(uint8_t *buffer, size_t len);
-int  rs485_write(uint8_t *buffer, size_t len);
-void rs485_flush(void);
+#define RS485_WAIT_FOREVER ((unsigned long)-1)
 
 
-#endif
\ No newline at end of file
+typedef enum {
+    RS485_EVENT_NONE = 0,
+    RS485_EVENT_DATA,
+    RS485_EVENT_ERROR,
+    // Bytes were lost and the receive buffer was flushed
+    RS485_EVENT_OVERRUN,
+} rs485_event_code_t;
+
+
+typedef struct {
+    rs485_event_code_t code;
+    // Number of bytes ready to be read (RS485_EVENT_DATA only)
+    size_t len;
+    // The line went idle after the last byte: the frame is complete
+    uint8_t frame_end;
+} rs485_event_t;
+
+
+void     rs485_init(int baud_rate);
+void     rs485_set_baudrate(uint32_t baud_rate);
+uint32_t rs485_get_baudrate(void);
+int      rs485_wait_event(rs485_event_t *event, unsigned long timeout_ms);
+int      rs485_read(uint8_t *buffer, size_t len);
+int      rs485_read_available(uint8_t *buffer, size_t len);
+int      rs485_write(uint8_t *buffer, size_t len);
+void     rs485_wait_tx_done(void);
+void     rs485_flush(void);
+
+
+#endif
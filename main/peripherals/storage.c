@@ -6,12 +6,21 @@
 #include "nvs_flash.h"
 #include "esp_log.h"
 
-#define COMPATIBILITY_KEY     "COMPATIBILITY"
-#define COMPATIBILITY_VERSION 1
+#define NAMESPACE "storage"
+
+
+static int load_result(esp_err_t err, char *key);
+static int save_result(esp_err_t err, char *key);
 
 
 static const char *TAG = "Storage";
 
+/*
+ *  The namespace is opened once and the handle kept for the whole application lifetime;
+ *  writes are not committed until storage_commit is called
+ */
+static nvs_handle_t handle;
+
 
 void storage_init(void) {
     // Initialize NVS
@@ -25,216 +34,110 @@ void storage_init(void) {
         ESP_ERROR_CHECK(err);
     }
 
-    nvs_handle_t handle;
-    ESP_ERROR_CHECK(nvs_open("storage", NVS_READWRITE, &handle));
-    uint8_t buf;
-    err = nvs_get_u8(handle, COMPATIBILITY_KEY, &buf);
-
-    if (err == ESP_OK) {
-        if (buf != COMPATIBILITY_VERSION) {
-            ESP_LOGI(TAG,
-                     "The previously saved configuration is not compatibile with the new firmware version; erasing...");
-            nvs_close(handle);
-            ESP_ERROR_CHECK(nvs_erase_all(handle));
-            ESP_ERROR_CHECK(nvs_set_u8(handle, COMPATIBILITY_KEY, COMPATIBILITY_VERSION));
-            ESP_ERROR_CHECK(nvs_commit(handle));
-        }
-    } else if (err == ESP_ERR_NVS_NOT_FOUND) {
-        ESP_ERROR_CHECK(nvs_set_u8(handle, COMPATIBILITY_KEY, COMPATIBILITY_VERSION));
-        ESP_ERROR_CHECK(nvs_commit(handle));
-    }
+    // Stored data is never erased here, upgrading older layouts is up to the configuration migrations
+    ESP_ERROR_CHECK(nvs_open(NAMESPACE, NVS_READWRITE, &handle));
 
-    nvs_close(handle);
     ESP_LOGI(TAG, "Storage initialized!");
 }
 
 
-int load_uint8_option(uint8_t *value, char *key) {
-    nvs_handle_t handle;
-    esp_err_t    err;
-    assert(strlen(key) <= 15);
-
-    ESP_ERROR_CHECK(nvs_open("storage", NVS_READONLY, &handle));
-    err = nvs_get_u8(handle, key, value);
-    nvs_close(handle);
-    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGE(TAG, "NVS error (%s) while reading %s", esp_err_to_name(err), key);
+/*
+ *  Makes every pending write persistent; returns 0 on success, -1 otherwise
+ */
+int storage_commit(void) {
+    esp_err_t err = nvs_commit(handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "NVS error (%s) while committing", esp_err_to_name(err));
         return -1;
-    } else if (err == ESP_ERR_NVS_NOT_FOUND) {
-        return 1;
     }
-
     return 0;
 }
 
 
-void save_uint8_option(uint8_t *value, char *key) {
-    nvs_handle_t handle;
+int load_uint8_option(uint8_t *value, char *key) {
     assert(strlen(key) <= 15);
-
-    esp_err_t err = nvs_open("storage", NVS_READWRITE, &handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error (%i) opening NVS handle!\n", err);
-        return;
-    }
-
-    err = nvs_set_u8(handle, key, *value);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "NVS error (%i) while writing %s", err, key);
-    } else {
-        ESP_ERROR_CHECK(nvs_commit(handle));
-        nvs_close(handle);
+    esp_err_t err = nvs_get_u8(handle, key, value);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return 1;
     }
+    return load_result(err, key);
 }
 
 
-int load_uint16_option(uint16_t *value, char *key) {
-    nvs_handle_t handle;
-    esp_err_t    err;
+int save_uint8_option(uint8_t *value, char *key) {
     assert(strlen(key) <= 15);
+    return save_result(nvs_set_u8(handle, key, *value), key);
+}
 
-    ESP_ERROR_CHECK(nvs_open("storage", NVS_READONLY, &handle));
-    err = nvs_get_u16(handle, key, value);
-    nvs_close(handle);
-    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGE(TAG, "NVS error (%s) while reading %s", esp_err_to_name(err), key);
-        return -1;
-    }
 
-    return 0;
+int load_uint16_option(uint16_t *value, char *key) {
+    assert(strlen(key) <= 15);
+    return load_result(nvs_get_u16(handle, key, value), key);
 }
 
 
-void save_uint16_option(uint16_t *value, char *key) {
-    nvs_handle_t handle;
+int save_uint16_option(uint16_t *value, char *key) {
     ESP_LOGI(TAG, "Trying to save key %s with value %X", key, *value);
     assert(strlen(key) <= 15);
-
-    esp_err_t err = nvs_open("storage", NVS_READWRITE, &handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error (%i) opening NVS handle!\n", err);
-        return;
-    }
-
-    err = nvs_set_u16(handle, key, *value);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "NVS error (%i) while writing %s", err, key);
-    } else {
-        ESP_ERROR_CHECK(nvs_commit(handle));
-        nvs_close(handle);
-    }
+    return save_result(nvs_set_u16(handle, key, *value), key);
 }
 
 
 int load_uint32_option(uint32_t *value, char *key) {
-    nvs_handle_t handle;
-    esp_err_t    err;
     assert(strlen(key) <= 15);
-
-    ESP_ERROR_CHECK(nvs_open("storage", NVS_READONLY, &handle));
-    err = nvs_get_u32(handle, key, value);
-    nvs_close(handle);
-    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGE(TAG, "NVS error (%s) while reading %s", esp_err_to_name(err), key);
-        return -1;
-    }
-
-    return 0;
+    return load_result(nvs_get_u32(handle, key, value), key);
 }
 
 
-void save_uint32_option(uint32_t *value, char *key) {
-    nvs_handle_t handle;
-    ESP_LOGI(TAG, "Trying to save key %s with value", key, *value);
+int save_uint32_option(uint32_t *value, char *key) {
+    ESP_LOGI(TAG, "Trying to save key %s with value %u", key, (unsigned int)*value);
     assert(strlen(key) <= 15);
-
-    esp_err_t err = nvs_open("storage", NVS_READWRITE, &handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error (%i) opening NVS handle!\n", err);
-        return;
-    }
-
-    err = nvs_set_u32(handle, key, *value);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "NVS error (%i) while writing %s", err, key);
-    } else {
-        ESP_ERROR_CHECK(nvs_commit(handle));
-        nvs_close(handle);
-    }
+    return save_result(nvs_set_u32(handle, key, *value), key);
 }
 
 
 int load_uint64_option(uint64_t *value, char *key) {
-    nvs_handle_t handle;
-    esp_err_t    err;
     assert(strlen(key) <= 15);
-
-    ESP_ERROR_CHECK(nvs_open("storage", NVS_READONLY, &handle));
-    err = nvs_get_u64(handle, key, value);
-    nvs_close(handle);
-    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGE(TAG, "NVS error (%s) while reading %s", esp_err_to_name(err), key);
-        return -1;
-    }
-
-    return 0;
+    return load_result(nvs_get_u64(handle, key, value), key);
 }
 
 
-void save_uint64_option(uint64_t *value, char *key) {
-    nvs_handle_t handle;
+int save_uint64_option(uint64_t *value, char *key) {
     ESP_LOGI(TAG, "Trying to save key %s", key);
     assert(strlen(key) <= 15);
+    return save_result(nvs_set_u64(handle, key, *value), key);
+}
 
-    esp_err_t err = nvs_open("storage", NVS_READWRITE, &handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error (%i) opening NVS handle!\n", err);
-        return;
-    }
 
-    err = nvs_set_u64(handle, key, *value);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "NVS error (%i) while writing %s", err, key);
-    } else {
-        ESP_ERROR_CHECK(nvs_commit(handle));
-        nvs_close(handle);
-    }
+int load_blob_option(void *value, size_t len, char *key) {
+    assert(strlen(key) <= 15);
+    return load_result(nvs_get_blob(handle, key, value, &len), key);
 }
 
 
-int load_blob_option(void *value, size_t len, char *key) {
-    nvs_handle_t handle;
-    esp_err_t    err;
+int save_blob_option(void *value, size_t len, char *key) {
+    ESP_LOGI(TAG, "Trying to save key %s", key);
     assert(strlen(key) <= 15);
+    return save_result(nvs_set_blob(handle, key, value, len), key);
+}
 
-    ESP_ERROR_CHECK(nvs_open("storage", NVS_READONLY, &handle));
-    err = nvs_get_blob(handle, key, value, &len);
-    nvs_close(handle);
+
+/*
+ *  A missing key is not an error: the caller keeps its default value
+ */
+static int load_result(esp_err_t err, char *key) {
     if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
         ESP_LOGE(TAG, "NVS error (%s) while reading %s", esp_err_to_name(err), key);
         return -1;
     }
-
     return 0;
 }
 
 
-void save_blob_option(void *value, size_t len, char *key) {
-    nvs_handle_t handle;
-    ESP_LOGI(TAG, "Trying to save key %s", key);
-    assert(strlen(key) <= 15);
-
-    esp_err_t err = nvs_open("storage", NVS_READWRITE, &handle);
+static int save_result(esp_err_t err, char *key) {
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error (%i) opening NVS handle!\n", err);
-        return;
-    }
-
-    err = nvs_set_blob(handle, key, value, len);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "NVS error (%i) while writing %s", err, key);
-    } else {
-        ESP_ERROR_CHECK(nvs_commit(handle));
-        nvs_close(handle);
+        ESP_LOGE(TAG, "NVS error (%s) while writing %s", esp_err_to_name(err), key);
+        return -1;
     }
+    return 0;
 }
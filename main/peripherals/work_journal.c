@@ -0,0 +1,168 @@
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include "esp_partition.h"
+#include "esp_log.h"
+#include "utils/crc16.h"
+#include "work_journal.h"
+
+
+#define PARTITION_LABEL "worktime"
+#define SECTOR_SIZE     4096
+
+
+/*
+ *  Append-only journal of the work seconds counter on a dedicated partition used as a ring of sectors.
+ *  Every save appends a record with an increasing sequence number; a sector is erased only when the ring wraps
+ *  around to it, while the other sectors still hold the latest records.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t sequence;
+    uint32_t work_seconds;
+    // Modbus CRC of the previous fields, tells a complete record from a torn write
+    uint16_t crc;
+    uint16_t reserved;
+} record_t;
+
+
+#define RECORDS_PER_SECTOR (SECTOR_SIZE / sizeof(record_t))
+
+
+static uint8_t  record_is_erased(const record_t *record);
+static uint16_t record_crc(const record_t *record);
+static size_t   slot_address(size_t slot);
+
+
+static const char *TAG = "WorkJournal";
+
+static struct {
+    const esp_partition_t *partition;
+    size_t                 slots;
+    // Where the next record goes
+    size_t   next_slot;
+    uint32_t sequence;
+    uint8_t  found;
+    uint32_t work_seconds;
+} journal = {0};
+
+
+void work_journal_init(void) {
+    memset(&journal, 0, sizeof(journal));
+    journal.partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, PARTITION_LABEL);
+    if (journal.partition == NULL) {
+        ESP_LOGE(TAG, "No %s partition", PARTITION_LABEL);
+        return;
+    }
+
+    size_t sectors = journal.partition->size / SECTOR_SIZE;
+    assert(sectors >= 2);
+    journal.slots = sectors * RECORDS_PER_SECTOR;
+
+    // Recover the latest record; the one after it is where the journal continues
+    size_t last_slot = 0;
+    for (size_t slot = 0; slot < journal.slots; slot++) {
+        record_t record;
+        if (esp_partition_read(journal.partition, slot_address(slot), &record, sizeof(record)) != ESP_OK) {
+            continue;
+        }
+        if (record_is_erased(&record) || record.crc != record_crc(&record)) {
+            continue;
+        }
+        if (!journal.found || record.sequence > journal.sequence) {
+            journal.found        = 1;
+            journal.sequence     = record.sequence;
+            journal.work_seconds = record.work_seconds;
+            last_slot            = slot;
+        }
+    }
+
+    journal.next_slot = journal.found ? (last_slot + 1) % journal.slots : 0;
+
+    // Skip whatever a torn write left behind; a fresh sector is erased anyway before the first append
+    while (journal.next_slot % RECORDS_PER_SECTOR != 0) {
+        record_t record;
+        esp_partition_read(journal.partition, slot_address(journal.next_slot), &record, sizeof(record));
+        if (record_is_erased(&record)) {
+            break;
+        }
+        journal.next_slot = (journal.next_slot + 1) % journal.slots;
+    }
+
+    ESP_LOGI(TAG, "Journal initialized (sequence %u, next slot %u)", (unsigned int)journal.sequence,
+             (unsigned int)journal.next_slot);
+}
+
+
+/*
+ *  Latest total recorded in the journal; returns 0 if found, 1 if the journal is empty and -1 if it is unavailable
+ */
+int work_journal_load(uint32_t *work_seconds) {
+    if (journal.partition == NULL) {
+        return -1;
+    } else if (!journal.found) {
+        return 1;
+    }
+
+    *work_seconds = journal.work_seconds;
+    return 0;
+}
+
+
+/*
+ *  Appends a new total; not reentrant, only the persistence task writes to the journal.
+ *  Returns 0 on success, -1 otherwise.
+ */
+int work_journal_append(uint32_t work_seconds) {
+    if (journal.partition == NULL) {
+        return -1;
+    }
+
+    size_t address = slot_address(journal.next_slot);
+    if (journal.next_slot % RECORDS_PER_SECTOR == 0) {
+        if (esp_partition_erase_range(journal.partition, address, SECTOR_SIZE) != ESP_OK) {
+            ESP_LOGE(TAG, "Unable to erase sector at 0x%X", (unsigned int)address);
+            return -1;
+        }
+    }
+
+    record_t record = {
+        .sequence     = journal.sequence + 1,
+        .work_seconds = work_seconds,
+        .reserved     = 0,
+    };
+    record.crc = record_crc(&record);
+
+    // The slot is consumed even if the write fails, it might be partially programmed
+    journal.next_slot = (journal.next_slot + 1) % journal.slots;
+
+    if (esp_partition_write(journal.partition, address, &record, sizeof(record)) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to write record at 0x%X", (unsigned int)address);
+        return -1;
+    }
+
+    journal.found        = 1;
+    journal.sequence     = record.sequence;
+    journal.work_seconds = work_seconds;
+    return 0;
+}
+
+
+static uint8_t record_is_erased(const record_t *record) {
+    const uint8_t *bytes = (const uint8_t *)record;
+    for (size_t i = 0; i < sizeof(*record); i++) {
+        if (bytes[i] != 0xFF) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+static uint16_t record_crc(const record_t *record) {
+    return crc16_modbus((const uint8_t *)record, offsetof(record_t, crc));
+}
+
+
+static size_t slot_address(size_t slot) {
+    return (slot / RECORDS_PER_SECTOR) * SECTOR_SIZE + (slot % RECORDS_PER_SECTOR) * sizeof(record_t);
+}
@@ -0,0 +1,13 @@
+#ifndef WORK_JOURNAL_H_INCLUDED
+#define WORK_JOURNAL_H_INCLUDED
+
+
+#include <stdint.h>
+
+
+void work_journal_init(void);
+int  work_journal_load(uint32_t *work_seconds);
+int  work_journal_append(uint32_t work_seconds);
+
+
+#endif
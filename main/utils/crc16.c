@@ -0,0 +1,96 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include "config/app_config.h"
+#include "crc16.h"
+
+
+#define CRC16_MODBUS_POLYNOMIAL 0xA001     // 0x8005 reflected
+
+
+/*
+ *  Lookup tables are built at startup so they end up in RAM rather than behind the flash cache.
+ *  tables[0] is the classic bytewise table, tables[1..3] extend it to 4 bytes per step.
+ */
+static uint16_t tables[4][256] = {0};
+
+
+void crc16_init(void) {
+    for (uint16_t i = 0; i < 256; i++) {
+        uint16_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC16_MODBUS_POLYNOMIAL : crc >> 1;
+        }
+        tables[0][i] = crc;
+    }
+
+    for (uint16_t i = 0; i < 256; i++) {
+        for (int slice = 1; slice < 4; slice++) {
+            uint16_t previous = tables[slice - 1][i];
+            tables[slice][i]  = (previous >> 8) ^ tables[0][previous & 0xFF];
+        }
+    }
+}
+
+
+/*
+ *  CRC of a whole frame with the implementation chosen by APP_CONFIG_CRC16_IMPLEMENTATION
+ */
+uint16_t crc16_modbus(const uint8_t *data, size_t len) {
+#if APP_CONFIG_CRC16_IMPLEMENTATION == CRC16_IMPLEMENTATION_SLICE_BY_4
+    return crc16_modbus_slice_by_4(data, len);
+#elif APP_CONFIG_CRC16_IMPLEMENTATION == CRC16_IMPLEMENTATION_TABLE
+    return crc16_modbus_table(data, len);
+#else
+    return crc16_modbus_bitwise(data, len);
+#endif
+}
+
+
+uint16_t crc16_modbus_update(uint16_t crc, uint8_t byte) {
+    return (crc >> 8) ^ tables[0][(crc ^ byte) & 0xFF];
+}
+
+
+uint16_t crc16_modbus_bitwise(const uint8_t *data, size_t len) {
+    uint16_t crc = CRC16_MODBUS_INIT;
+
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC16_MODBUS_POLYNOMIAL : crc >> 1;
+        }
+    }
+
+    return crc;
+}
+
+
+uint16_t crc16_modbus_table(const uint8_t *data, size_t len) {
+    uint16_t crc = CRC16_MODBUS_INIT;
+
+    for (size_t i = 0; i < len; i++) {
+        crc = (crc >> 8) ^ tables[0][(crc ^ data[i]) & 0xFF];
+    }
+
+    return crc;
+}
+
+
+uint16_t crc16_modbus_slice_by_4(const uint8_t *data, size_t len) {
+    uint16_t crc = CRC16_MODBUS_INIT;
+
+    while (len >= 4) {
+        // The 16 bit CRC only overlaps the first two bytes of the block
+        uint8_t b0 = data[0] ^ (crc & 0xFF);
+        uint8_t b1 = data[1] ^ (crc >> 8);
+        crc        = tables[3][b0] ^ tables[2][b1] ^ tables[1][data[2]] ^ tables[0][data[3]];
+        data += 4;
+        len -= 4;
+    }
+
+    while (len-- > 0) {
+        crc = (crc >> 8) ^ tables[0][(crc ^ *data++) & 0xFF];
+    }
+
+    return crc;
+}
@@ -0,0 +1,24 @@
+#ifndef CRC16_H_INCLUDED
+#define CRC16_H_INCLUDED
+
+
+#include <stdint.h>
+#include <stdlib.h>
+
+
+#define CRC16_MODBUS_INIT 0xFFFF
+
+#define CRC16_IMPLEMENTATION_BITWISE    0
+#define CRC16_IMPLEMENTATION_TABLE      1
+#define CRC16_IMPLEMENTATION_SLICE_BY_4 2
+
+
+void     crc16_init(void);
+uint16_t crc16_modbus(const uint8_t *data, size_t len);
+uint16_t crc16_modbus_update(uint16_t crc, uint8_t byte);
+uint16_t crc16_modbus_bitwise(const uint8_t *data, size_t len);
+uint16_t crc16_modbus_table(const uint8_t *data, size_t len);
+uint16_t crc16_modbus_slice_by_4(const uint8_t *data, size_t len);
+
+
+#endif
@@ -0,0 +1,133 @@
+#include <assert.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "utils/utils.h"
+#include "config/app_config.h"
+#include "event_loop.h"
+
+
+// Leds, retained data and heartbeat, plus check, retry and stable feedback for every relay channel
+#define MAX_TIMERS (3 + 3 * APP_CONFIG_RELE_CHANNELS)
+// Keeps the conversion to ticks from overflowing, waking up once in a while costs nothing
+#define MAX_BLOCK_MS (60UL * 1000UL)
+
+// Internal: a timer was armed from another task and may be the new earliest deadline
+#define EVENT_RESCHEDULE 0x80000000UL
+
+
+static void run_expired_timers(void);
+
+
+static const char *TAG = "EventLoop";
+
+/*
+ *  Events are task notification bits of the loop task; timers live in a single deadline heap, so the loop
+ *  always knows how long it can sleep
+ */
+static struct {
+    TaskHandle_t       task;
+    SemaphoreHandle_t  sem;
+    StaticSemaphore_t  semaphore_buffer;
+    scheduler_t        scheduler;
+    scheduler_timer_t *heap[MAX_TIMERS];
+} loop = {0};
+
+
+/*
+ *  The calling task is the one running the loop
+ */
+void event_loop_init(void) {
+    loop.task = xTaskGetCurrentTaskHandle();
+    loop.sem  = xSemaphoreCreateMutexStatic(&loop.semaphore_buffer);
+    scheduler_init(&loop.scheduler, loop.heap, MAX_TIMERS);
+}
+
+
+/*
+ *  Wakes the loop up; safe from any task
+ */
+void event_loop_post(uint32_t events) {
+    if (loop.task != NULL) {
+        xTaskNotify(loop.task, events, eSetBits);
+    }
+}
+
+
+/*
+ *  (Re)schedules the timer `delay_ms` from now; its callback runs in the loop task.
+ *  Every timer in the firmware has a slot reserved in MAX_TIMERS, so running out of them is a programming error.
+ */
+int event_loop_arm(scheduler_timer_t *timer, unsigned long delay_ms) {
+    xSemaphoreTake(loop.sem, portMAX_DELAY);
+    int res = scheduler_arm(&loop.scheduler, timer, get_millis() + delay_ms);
+    // The loop may be sleeping on a later deadline
+    uint8_t earliest = res == 0 && timer->position == 1;
+    xSemaphoreGive(loop.sem);
+
+    if (res) {
+        ESP_LOGE(TAG, "No room for another timer");
+        assert(0);
+    } else if (earliest && xTaskGetCurrentTaskHandle() != loop.task) {
+        event_loop_post(EVENT_RESCHEDULE);
+    }
+    return res;
+}
+
+
+void event_loop_cancel(scheduler_timer_t *timer) {
+    xSemaphoreTake(loop.sem, portMAX_DELAY);
+    scheduler_cancel(&loop.scheduler, timer);
+    xSemaphoreGive(loop.sem);
+}
+
+
+/*
+ *  An expired timer is disarmed before its callback runs: if it is armed again by then, the callback is stale
+ */
+uint8_t event_loop_is_armed(scheduler_timer_t *timer) {
+    xSemaphoreTake(loop.sem, portMAX_DELAY);
+    uint8_t armed = scheduler_is_armed(timer);
+    xSemaphoreGive(loop.sem);
+    return armed;
+}
+
+
+/*
+ *  Sleeps until an event is posted or the earliest timer expires, runs the expired timers and returns the
+ *  events received (possibly none)
+ */
+uint32_t event_loop_wait(void) {
+    assert(xTaskGetCurrentTaskHandle() == loop.task);
+    run_expired_timers();
+
+    xSemaphoreTake(loop.sem, portMAX_DELAY);
+    unsigned long delay = scheduler_next_delay(&loop.scheduler, get_millis());
+    xSemaphoreGive(loop.sem);
+
+    if (delay > MAX_BLOCK_MS) {
+        delay = MAX_BLOCK_MS;
+    }
+
+    uint32_t events = 0;
+    xTaskNotifyWait(0, UINT32_MAX, &events, pdMS_TO_TICKS(delay));
+    run_expired_timers();
+
+    return events & ~EVENT_RESCHEDULE;
+}
+
+
+static void run_expired_timers(void) {
+    for (;;) {
+        xSemaphoreTake(loop.sem, portMAX_DELAY);
+        scheduler_timer_t *timer = scheduler_pop_expired(&loop.scheduler, get_millis());
+        xSemaphoreGive(loop.sem);
+
+        if (timer == NULL) {
+            break;
+        }
+        // Outside of the lock, the callback is free to arm timers again
+        timer->callback(timer->arg);
+    }
+}
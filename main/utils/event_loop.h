@@ -0,0 +1,22 @@
+#ifndef EVENT_LOOP_H_INCLUDED
+#define EVENT_LOOP_H_INCLUDED
+
+
+#include <stdint.h>
+#include "scheduler.h"
+
+
+#define EVENT_LOOP_INPUT   0x01
+#define EVENT_LOOP_MODBUS  0x02
+#define EVENT_LOOP_CONSOLE 0x04
+
+
+void     event_loop_init(void);
+void     event_loop_post(uint32_t events);
+int      event_loop_arm(scheduler_timer_t *timer, unsigned long delay_ms);
+void     event_loop_cancel(scheduler_timer_t *timer);
+uint8_t  event_loop_is_armed(scheduler_timer_t *timer);
+uint32_t event_loop_wait(void);
+
+
+#endif
@@ -0,0 +1,159 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "scheduler.h"
+
+
+static uint8_t comes_before(const scheduler_timer_t *first, const scheduler_timer_t *second);
+static void    place(scheduler_t *scheduler, size_t index, scheduler_timer_t *timer);
+static void    sift_up(scheduler_t *scheduler, size_t index);
+static void    sift_down(scheduler_t *scheduler, size_t index);
+static void    remove_at(scheduler_t *scheduler, size_t index);
+
+
+void scheduler_init(scheduler_t *scheduler, scheduler_timer_t **heap, size_t capacity) {
+    assert(scheduler != NULL);
+    scheduler->heap     = heap;
+    scheduler->capacity = capacity;
+    scheduler->count    = 0;
+}
+
+
+void scheduler_timer_init(scheduler_timer_t *timer, scheduler_callback_t callback, void *arg) {
+    assert(timer != NULL);
+    timer->deadline = 0;
+    timer->callback = callback;
+    timer->arg      = arg;
+    timer->position = 0;
+}
+
+
+/*
+ *  Schedules the timer at `deadline` (milliseconds), moving it if it was already armed.
+ *  Returns 0 on success, -1 if the heap is full.
+ */
+int scheduler_arm(scheduler_t *scheduler, scheduler_timer_t *timer, unsigned long deadline) {
+    assert(scheduler != NULL && timer != NULL);
+
+    if (timer->position > 0) {
+        size_t index    = timer->position - 1;
+        timer->deadline = deadline;
+        sift_up(scheduler, index);
+        sift_down(scheduler, timer->position - 1);
+        return 0;
+    } else if (scheduler->count >= scheduler->capacity) {
+        return -1;
+    }
+
+    timer->deadline = deadline;
+    place(scheduler, scheduler->count++, timer);
+    sift_up(scheduler, scheduler->count - 1);
+    return 0;
+}
+
+
+void scheduler_cancel(scheduler_t *scheduler, scheduler_timer_t *timer) {
+    assert(scheduler != NULL && timer != NULL);
+    if (timer->position > 0) {
+        remove_at(scheduler, timer->position - 1);
+    }
+}
+
+
+uint8_t scheduler_is_armed(const scheduler_timer_t *timer) {
+    return timer->position > 0;
+}
+
+
+/*
+ *  Milliseconds until the earliest deadline, 0 if it already passed and SCHEDULER_NO_DEADLINE if nothing is armed
+ */
+unsigned long scheduler_next_delay(scheduler_t *scheduler, unsigned long now) {
+    if (scheduler->count == 0) {
+        return SCHEDULER_NO_DEADLINE;
+    }
+
+    long delay = (long)(scheduler->heap[0]->deadline - now);
+    return delay > 0 ? (unsigned long)delay : 0;
+}
+
+
+/*
+ *  Disarms and returns the earliest timer if its deadline passed, NULL otherwise.
+ *  The callback is left to the caller, so that it can run outside of any lock protecting the scheduler.
+ */
+scheduler_timer_t *scheduler_pop_expired(scheduler_t *scheduler, unsigned long now) {
+    if (scheduler->count == 0 || (long)(scheduler->heap[0]->deadline - now) > 0) {
+        return NULL;
+    }
+
+    scheduler_timer_t *timer = scheduler->heap[0];
+    remove_at(scheduler, 0);
+    return timer;
+}
+
+
+/*
+ *  Deadlines are compared through their difference, which stays correct across the millisecond counter overflow
+ *  as long as they are less than half the range apart
+ */
+static uint8_t comes_before(const scheduler_timer_t *first, const scheduler_timer_t *second) {
+    return (long)(first->deadline - second->deadline) < 0;
+}
+
+
+static void place(scheduler_t *scheduler, size_t index, scheduler_timer_t *timer) {
+    scheduler->heap[index] = timer;
+    timer->position        = index + 1;
+}
+
+
+static void sift_up(scheduler_t *scheduler, size_t index) {
+    scheduler_timer_t *timer = scheduler->heap[index];
+
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (!comes_before(timer, scheduler->heap[parent])) {
+            break;
+        }
+        place(scheduler, index, scheduler->heap[parent]);
+        index = parent;
+    }
+
+    place(scheduler, index, timer);
+}
+
+
+static void sift_down(scheduler_t *scheduler, size_t index) {
+    scheduler_timer_t *timer = scheduler->heap[index];
+
+    for (;;) {
+        size_t child = 2 * index + 1;
+        if (child >= scheduler->count) {
+            break;
+        }
+        if (child + 1 < scheduler->count && comes_before(scheduler->heap[child + 1], scheduler->heap[child])) {
+            child++;
+        }
+        if (!comes_before(scheduler->heap[child], timer)) {
+            break;
+        }
+        place(scheduler, index, scheduler->heap[child]);
+        index = child;
+    }
+
+    place(scheduler, index, timer);
+}
+
+
+static void remove_at(scheduler_t *scheduler, size_t index) {
+    scheduler_timer_t *removed = scheduler->heap[index];
+    scheduler_timer_t *last    = scheduler->heap[--scheduler->count];
+    removed->position          = 0;
+
+    if (last != removed) {
+        place(scheduler, index, last);
+        sift_up(scheduler, index);
+        sift_down(scheduler, last->position - 1);
+    }
+}
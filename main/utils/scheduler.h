@@ -0,0 +1,44 @@
+#ifndef SCHEDULER_H_INCLUDED
+#define SCHEDULER_H_INCLUDED
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
+
+
+#define SCHEDULER_NO_DEADLINE ULONG_MAX
+
+
+typedef void (*scheduler_callback_t)(void *arg);
+
+
+typedef struct {
+    unsigned long        deadline;
+    scheduler_callback_t callback;
+    void                *arg;
+    // Position in the heap plus one, 0 while the timer is not armed
+    size_t position;
+} scheduler_timer_t;
+
+
+/*
+ *  Binary min-heap of armed timers ordered by deadline; the storage is provided by the user
+ */
+typedef struct {
+    scheduler_timer_t **heap;
+    size_t              capacity;
+    size_t              count;
+} scheduler_t;
+
+
+void               scheduler_init(scheduler_t *scheduler, scheduler_timer_t **heap, size_t capacity);
+void               scheduler_timer_init(scheduler_timer_t *timer, scheduler_callback_t callback, void *arg);
+int                scheduler_arm(scheduler_t *scheduler, scheduler_timer_t *timer, unsigned long deadline);
+void               scheduler_cancel(scheduler_t *scheduler, scheduler_timer_t *timer);
+uint8_t            scheduler_is_armed(const scheduler_timer_t *timer);
+unsigned long      scheduler_next_delay(scheduler_t *scheduler, unsigned long now);
+scheduler_timer_t *scheduler_pop_expired(scheduler_t *scheduler, unsigned long now);
+
+
+#endif
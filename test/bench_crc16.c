@@ -0,0 +1,73 @@
+/*
+ *  Host benchmark of the Modbus CRC implementations (main/utils/crc16.c), same table as the BenchCRC console
+ *  command on the target. Numbers are only comparable with each other, not with the ESP32-C3 ones.
+ */
+#undef NDEBUG
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "utils/crc16.h"
+
+
+#define DEFAULT_REPETITIONS 100000
+#define MAX_FRAME_SIZE      256
+
+
+static int64_t get_nanoseconds(void);
+
+
+int main(int argc, char **argv) {
+    const struct {
+        const char *name;
+        uint16_t (*crc)(const uint8_t *, size_t);
+    } implementations[] = {
+        {"bitwise", crc16_modbus_bitwise},
+        {"table", crc16_modbus_table},
+        {"slice-by-4", crc16_modbus_slice_by_4},
+    };
+    const size_t implementations_num = sizeof(implementations) / sizeof(implementations[0]);
+
+    int repetitions = argc > 1 && atoi(argv[1]) > 0 ? atoi(argv[1]) : DEFAULT_REPETITIONS;
+
+    crc16_init();
+
+    static uint8_t frame[MAX_FRAME_SIZE] = {0};
+    srand(1);
+    for (size_t i = 0; i < sizeof(frame); i++) {
+        frame[i] = (uint8_t)rand();
+    }
+
+    // A faster implementation is worthless if it disagrees, odd lengths included
+    for (size_t size = 0; size <= sizeof(frame); size++) {
+        for (size_t i = 1; i < implementations_num; i++) {
+            assert(implementations[i].crc(frame, size) == implementations[0].crc(frame, size));
+        }
+    }
+
+    printf("%-12s %8s %8s %8s %8s %8s %8s   (ns per frame)\n", "", "8", "16", "32", "64", "128", "256");
+    for (size_t i = 0; i < implementations_num; i++) {
+        printf("%-12s", implementations[i].name);
+        for (size_t size = 8; size <= sizeof(frame); size *= 2) {
+            volatile uint16_t sink  = 0;
+            int64_t           start = get_nanoseconds();
+            for (int j = 0; j < repetitions; j++) {
+                sink ^= implementations[i].crc(frame, size);
+            }
+            int64_t elapsed = get_nanoseconds() - start;
+            (void)sink;
+            printf(" %8lu", (unsigned long)(elapsed / repetitions));
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
+
+
+static int64_t get_nanoseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
@@ -0,0 +1,80 @@
+/*
+ *  Host benchmark of the model reads (main/model/model.c), same table as the BenchModel console command on the
+ *  target. The reference path takes a pthread mutex, the host counterpart of the FreeRTOS one the getters used
+ *  before the sequence counter; numbers are only comparable with each other.
+ */
+#undef NDEBUG
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "model/model.h"
+
+
+#define DEFAULT_REPETITIONS 1000000
+
+
+static int64_t get_nanoseconds(void);
+static void    print_result(const char *name, int64_t start, int repetitions);
+
+
+int main(int argc, char **argv) {
+    static model_t    model;
+    static model_t    snapshot;
+    pthread_mutex_t   mutex       = PTHREAD_MUTEX_INITIALIZER;
+    volatile uint32_t sink        = 0;
+    int               repetitions = argc > 1 && atoi(argv[1]) > 0 ? atoi(argv[1]) : DEFAULT_REPETITIONS;
+    int64_t           start;
+
+    model_init(&model);
+    model_set_work_seconds(&model, 1234);
+    assert(model_get_work_seconds(&model) == 1234);
+
+    printf("%-20s %10s\n", "", "ns per read");
+
+    start = get_nanoseconds();
+    for (int i = 0; i < repetitions; i++) {
+        pthread_mutex_lock(&mutex);
+        sink ^= model.work_seconds;
+        pthread_mutex_unlock(&mutex);
+    }
+    print_result("field, mutex", start, repetitions);
+
+    start = get_nanoseconds();
+    for (int i = 0; i < repetitions; i++) {
+        sink ^= model_get_work_seconds(&model);
+    }
+    print_result("field, lock-free", start, repetitions);
+
+    start = get_nanoseconds();
+    for (int i = 0; i < repetitions; i++) {
+        pthread_mutex_lock(&mutex);
+        memcpy(&snapshot, &model, sizeof(snapshot));
+        pthread_mutex_unlock(&mutex);
+    }
+    print_result("snapshot, mutex", start, repetitions);
+
+    start = get_nanoseconds();
+    for (int i = 0; i < repetitions; i++) {
+        model_get_snapshot(&model, &snapshot);
+    }
+    print_result("snapshot, lock-free", start, repetitions);
+
+    (void)sink;
+    return 0;
+}
+
+
+static void print_result(const char *name, int64_t start, int repetitions) {
+    printf("%-20s %10lu\n", name, (unsigned long)((get_nanoseconds() - start) / repetitions));
+}
+
+
+static int64_t get_nanoseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
@@ -0,0 +1,28 @@
+#ifndef EASYCONNECT_H_INCLUDED
+#define EASYCONNECT_H_INCLUDED
+
+/*
+ *  The parts of the easyconnect-device component the modules under test rely on
+ */
+
+#include <stdint.h>
+
+
+#define EASYCONNECT_MESSAGE_SIZE 32
+
+#define CLASS_CONFIGURABLE_MASK 0xFFF
+#define CLASS(mode, group)      ((uint16_t)(((mode) << 8) | (group)))
+#define CLASS_GET_MODE(class)   (((class) >> 8) & 0xF)
+
+#define DEVICE_MODE_LIGHT  1
+#define DEVICE_MODE_UVC    2
+#define DEVICE_MODE_ESF    3
+#define DEVICE_MODE_GAS    4
+#define DEVICE_MODE_SAFETY 5
+
+#define DEVICE_GROUP_1 1
+
+#define EASYCONNECT_DEVICE_RELE_PERIPHERAL 1
+
+
+#endif
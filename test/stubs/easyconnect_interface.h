@@ -0,0 +1,7 @@
+#ifndef EASYCONNECT_INTERFACE_H_INCLUDED
+#define EASYCONNECT_INTERFACE_H_INCLUDED
+
+#include "easyconnect.h"
+
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef FREERTOS_H_INCLUDED
+#define FREERTOS_H_INCLUDED
+
+/*
+ *  Single task stand-in for FreeRTOS, just enough for the modules under test (see stubs.c)
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+
+
+#define portMAX_DELAY       0xFFFFFFFFUL
+#define portTICK_PERIOD_MS  1
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+#define pdTRUE              1
+#define pdFALSE             0
+#define pdPASS              1
+#define configMAX_PRIORITIES 25
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_NOINIT_ATTR
+
+
+typedef uint32_t TickType_t;
+typedef int      BaseType_t;
+typedef unsigned UBaseType_t;
+
+typedef struct {
+    int taken;
+} StaticSemaphore_t;
+typedef StaticSemaphore_t *SemaphoreHandle_t;
+
+typedef struct {
+    int dummy;
+} StaticTask_t;
+typedef StaticTask_t *TaskHandle_t;
+
+typedef struct {
+    int dummy;
+} StaticTimer_t;
+typedef StaticTimer_t *TimerHandle_t;
+
+
+#endif
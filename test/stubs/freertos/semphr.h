@@ -0,0 +1,12 @@
+#ifndef SEMPHR_H_INCLUDED
+#define SEMPHR_H_INCLUDED
+
+#include "FreeRTOS.h"
+
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer);
+BaseType_t        xSemaphoreTake(SemaphoreHandle_t sem, TickType_t timeout);
+BaseType_t        xSemaphoreGive(SemaphoreHandle_t sem);
+
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef TASK_H_INCLUDED
+#define TASK_H_INCLUDED
+
+#include "FreeRTOS.h"
+
+
+typedef void (*TaskFunction_t)(void *);
+
+
+/*
+ *  Tasks are never run, the test drives the module from the outside
+ */
+TaskHandle_t xTaskCreateStatic(TaskFunction_t function, const char *name, uint32_t stack_depth, void *args,
+                               UBaseType_t priority, uint8_t *stack, StaticTask_t *task_buffer);
+void         vTaskDelete(TaskHandle_t task);
+void         vTaskDelay(TickType_t ticks);
+TickType_t   xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t   xTaskNotifyGive(TaskHandle_t task);
+uint32_t     ulTaskNotifyTake(BaseType_t clear, TickType_t timeout);
+
+// Test control: moves the tick count forward
+void stubs_advance_ticks(TickType_t ticks);
+
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef TIMERS_H_INCLUDED
+#define TIMERS_H_INCLUDED
+
+#include "FreeRTOS.h"
+
+
+#endif
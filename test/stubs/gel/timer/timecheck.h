@@ -0,0 +1,9 @@
+#ifndef TIMECHECK_H_INCLUDED
+#define TIMECHECK_H_INCLUDED
+
+
+int           is_expired(unsigned long start, unsigned long current, unsigned long delay);
+unsigned long time_interval(unsigned long a, unsigned long b);
+
+
+#endif
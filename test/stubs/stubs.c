@@ -0,0 +1,81 @@
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "gel/timer/timecheck.h"
+
+
+static TickType_t   ticks = 0;
+static StaticTask_t current_task;
+
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t function, const char *name, uint32_t stack_depth, void *args,
+                               UBaseType_t priority, uint8_t *stack, StaticTask_t *task_buffer) {
+    return task_buffer;
+}
+
+
+void vTaskDelete(TaskHandle_t task) {}
+
+
+void vTaskDelay(TickType_t delay) {
+    ticks += delay;
+}
+
+
+TickType_t xTaskGetTickCount(void) {
+    return ticks;
+}
+
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return &current_task;
+}
+
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    return pdPASS;
+}
+
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t timeout) {
+    return 0;
+}
+
+
+void stubs_advance_ticks(TickType_t delay) {
+    ticks += delay;
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer) {
+    buffer->taken = 0;
+    return buffer;
+}
+
+
+/*
+ *  There is a single task: taking a mutex twice would be a deadlock on the target
+ */
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t timeout) {
+    assert(!sem->taken);
+    sem->taken = 1;
+    return pdTRUE;
+}
+
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    assert(sem->taken);
+    sem->taken = 0;
+    return pdTRUE;
+}
+
+
+int is_expired(unsigned long start, unsigned long current, unsigned long delay) {
+    return time_interval(start, current) >= delay;
+}
+
+
+unsigned long time_interval(unsigned long a, unsigned long b) {
+    return b - a;
+}
@@ -0,0 +1,360 @@
+/*
+ *  Host test of the stored configuration versioning (main/controller/configuration.c): migrations between
+ *  versions and the fallbacks on a missing or damaged record, on top of an in-memory storage
+ */
+#undef NDEBUG
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "model/model.h"
+#include "peripherals/storage.h"
+#include "peripherals/work_journal.h"
+#include "peripherals/retained.h"
+#include "controller/bus_activity.h"
+#include "controller/configuration.h"
+#include "utils/crc16.h"
+
+
+// Keys as stored by the module under test
+#define COMPATIBILITY_KEY  "COMPATIBILITY"
+#define RECORD_KEY         "CONFIG"
+#define ADDRESS_KEY        "indirizzo"
+#define SERIAL_NUM_KEY     "numeroseriale"
+#define FEEDBACK_DELAY_KEY "FBDELAY"
+
+#define CURRENT_VERSION 2
+
+#define MAX_ENTRIES 16
+
+
+static void    test_fresh_device(void);
+static void    test_legacy_keys_migrated(void);
+static void    test_version_zero(void);
+static void    test_current_version(void);
+static void    test_newer_version(void);
+static void    test_failed_migration(void);
+static void    test_interrupted_migration(void);
+static void    boot(model_t *pmodel);
+static void    store_legacy_keys(uint16_t address, uint32_t serial_number, uint8_t feedback_delay);
+static void    store_version(uint8_t version);
+static uint8_t stored_version(void);
+static void    reset_storage(void);
+
+
+/*
+ *  In-memory NVS namespace, with the same return values as peripherals/storage.c
+ */
+static struct {
+    struct {
+        char    key[16];
+        uint8_t data[128];
+        size_t  len;
+    } entries[MAX_ENTRIES];
+    size_t count;
+    // Writes to this key fail, as on a full or worn out partition
+    const char *failing_key;
+} storage = {0};
+
+
+int main(void) {
+    crc16_init();
+
+    test_fresh_device();
+    test_legacy_keys_migrated();
+    test_version_zero();
+    test_current_version();
+    test_newer_version();
+    test_failed_migration();
+    test_interrupted_migration();
+    printf("test_configuration: OK\n");
+    return 0;
+}
+
+
+/*
+ *  Nothing stored: the defaults are kept and saved as the current version
+ */
+static void test_fresh_device(void) {
+    model_t model;
+    reset_storage();
+
+    boot(&model);
+    assert(model_get_address(&model) == EASYCONNECT_DEFAULT_MINION_ADDRESS);
+    assert(model_get_feedback_delay(&model) == EASYCONNECT_DEFAULT_FEEDBACK_DELAY);
+    assert(stored_version() == CURRENT_VERSION);
+}
+
+
+/*
+ *  Version 1 keeps one key per setting: they are moved into the record, which is used from then on
+ */
+static void test_legacy_keys_migrated(void) {
+    model_t model;
+    reset_storage();
+    store_version(1);
+    store_legacy_keys(7, 1234, 3);
+
+    boot(&model);
+    assert(model_get_address(&model) == 7);
+    assert(model_get_serial_number(&model) == 1234);
+    assert(model_get_feedback_delay(&model) == 3);
+    assert(stored_version() == CURRENT_VERSION);
+
+    // The keys are not read anymore
+    store_legacy_keys(9, 9999, 5);
+    boot(&model);
+    assert(model_get_address(&model) == 7);
+    assert(model_get_serial_number(&model) == 1234);
+    assert(stored_version() == CURRENT_VERSION);
+}
+
+
+/*
+ *  Version 0 was written by the first releases and means version 1
+ */
+static void test_version_zero(void) {
+    model_t model;
+    reset_storage();
+    store_version(0);
+    store_legacy_keys(8, 42, 2);
+
+    boot(&model);
+    assert(model_get_address(&model) == 8);
+    assert(model_get_feedback_delay(&model) == 2);
+    assert(stored_version() == CURRENT_VERSION);
+}
+
+
+/*
+ *  At the current version a damaged record falls back to the defaults, the legacy keys are stale by now
+ */
+static void test_current_version(void) {
+    model_t model;
+    reset_storage();
+    store_version(1);
+    store_legacy_keys(7, 1234, 3);
+    boot(&model);
+    assert(model_get_address(&model) == 7);
+
+    for (size_t i = 0; i < storage.count; i++) {
+        if (strcmp(storage.entries[i].key, RECORD_KEY) == 0) {
+            storage.entries[i].data[2] ^= 0xFF;
+        }
+    }
+
+    boot(&model);
+    assert(model_get_address(&model) == EASYCONNECT_DEFAULT_MINION_ADDRESS);
+    assert(model_get_serial_number(&model) == EASYCONNECT_DEFAULT_MINION_SERIAL_NUMBER);
+    assert(model_get_feedback_delay(&model) == EASYCONNECT_DEFAULT_FEEDBACK_DELAY);
+    assert(stored_version() == CURRENT_VERSION);
+
+    // The defaults were saved as the new record
+    store_legacy_keys(9, 9999, 5);
+    boot(&model);
+    assert(model_get_address(&model) == EASYCONNECT_DEFAULT_MINION_ADDRESS);
+}
+
+
+/*
+ *  A version written by a newer firmware is left untouched and its keys are not guessed at
+ */
+static void test_newer_version(void) {
+    model_t model;
+    reset_storage();
+    store_version(CURRENT_VERSION + 1);
+    store_legacy_keys(7, 1234, 3);
+
+    boot(&model);
+    assert(stored_version() == CURRENT_VERSION + 1);
+    assert(model_get_address(&model) == EASYCONNECT_DEFAULT_MINION_ADDRESS);
+    assert(model_get_feedback_delay(&model) == EASYCONNECT_DEFAULT_FEEDBACK_DELAY);
+}
+
+
+/*
+ *  A migration step that fails keeps the old version, so that it is tried again at the next boot; meanwhile the
+ *  configuration still comes from the legacy keys
+ */
+static void test_failed_migration(void) {
+    model_t model;
+    reset_storage();
+    store_version(1);
+    store_legacy_keys(7, 1234, 3);
+
+    storage.failing_key = RECORD_KEY;
+    boot(&model);
+    assert(stored_version() == 1);
+    assert(model_get_address(&model) == 7);
+    assert(model_get_feedback_delay(&model) == 3);
+
+    storage.failing_key = NULL;
+    boot(&model);
+    assert(stored_version() == CURRENT_VERSION);
+    assert(model_get_address(&model) == 7);
+    assert(model_get_serial_number(&model) == 1234);
+}
+
+
+/*
+ *  Power lost after the record was written but before the version: the step runs again from the legacy keys,
+ *  which are still there, and gives the same result
+ */
+static void test_interrupted_migration(void) {
+    model_t model;
+    reset_storage();
+    store_version(1);
+    store_legacy_keys(7, 1234, 3);
+    boot(&model);
+    assert(stored_version() == CURRENT_VERSION);
+
+    store_version(1);
+    boot(&model);
+    assert(stored_version() == CURRENT_VERSION);
+    assert(model_get_address(&model) == 7);
+    assert(model_get_serial_number(&model) == 1234);
+    assert(model_get_feedback_delay(&model) == 3);
+}
+
+
+static void boot(model_t *pmodel) {
+    model_init(pmodel);
+    configuration_init(pmodel);
+}
+
+
+static void store_legacy_keys(uint16_t address, uint32_t serial_number, uint8_t feedback_delay) {
+    assert(save_uint16_option(&address, ADDRESS_KEY) == 0);
+    assert(save_uint32_option(&serial_number, SERIAL_NUM_KEY) == 0);
+    assert(save_uint8_option(&feedback_delay, FEEDBACK_DELAY_KEY) == 0);
+}
+
+
+static void store_version(uint8_t version) {
+    assert(save_uint8_option(&version, COMPATIBILITY_KEY) == 0);
+}
+
+
+static uint8_t stored_version(void) {
+    uint8_t version = 0;
+    assert(load_uint8_option(&version, COMPATIBILITY_KEY) == 0);
+    return version;
+}
+
+
+static void reset_storage(void) {
+    memset(&storage, 0, sizeof(storage));
+}
+
+
+static int load(void *value, size_t len, char *key) {
+    for (size_t i = 0; i < storage.count; i++) {
+        if (strcmp(storage.entries[i].key, key) == 0) {
+            if (storage.entries[i].len > len) {
+                return -1;
+            }
+            memcpy(value, storage.entries[i].data, storage.entries[i].len);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+static int save(const void *value, size_t len, char *key) {
+    assert(strlen(key) <= 15 && len <= sizeof(storage.entries[0].data));
+    if (storage.failing_key != NULL && strcmp(storage.failing_key, key) == 0) {
+        return -1;
+    }
+
+    size_t i = 0;
+    while (i < storage.count && strcmp(storage.entries[i].key, key) != 0) {
+        i++;
+    }
+    if (i == storage.count) {
+        assert(storage.count < MAX_ENTRIES);
+        strcpy(storage.entries[storage.count++].key, key);
+    }
+    memcpy(storage.entries[i].data, value, len);
+    storage.entries[i].len = len;
+    return 0;
+}
+
+
+void storage_init(void) {}
+
+
+int storage_commit(void) {
+    return 0;
+}
+
+
+int load_uint8_option(uint8_t *value, char *key) {
+    return load(value, sizeof(*value), key);
+}
+
+
+int save_uint8_option(uint8_t *value, char *key) {
+    return save(value, sizeof(*value), key);
+}
+
+
+// Only the 8 bit load tells a missing key apart, the others leave the value untouched and succeed
+int load_uint16_option(uint16_t *value, char *key) {
+    return load(value, sizeof(*value), key) < 0 ? -1 : 0;
+}
+
+
+int save_uint16_option(uint16_t *value, char *key) {
+    return save(value, sizeof(*value), key);
+}
+
+
+int load_uint32_option(uint32_t *value, char *key) {
+    return load(value, sizeof(*value), key) < 0 ? -1 : 0;
+}
+
+
+int save_uint32_option(uint32_t *value, char *key) {
+    return save(value, sizeof(*value), key);
+}
+
+
+int load_uint64_option(uint64_t *value, char *key) {
+    return load(value, sizeof(*value), key) < 0 ? -1 : 0;
+}
+
+
+int save_uint64_option(uint64_t *value, char *key) {
+    return save(value, sizeof(*value), key);
+}
+
+
+int load_blob_option(void *value, size_t len, char *key) {
+    return load(value, len, key) < 0 ? -1 : 0;
+}
+
+
+int save_blob_option(void *value, size_t len, char *key) {
+    return save(value, len, key);
+}
+
+
+int work_journal_load(uint32_t *work_seconds) {
+    return -1;
+}
+
+
+int work_journal_append(uint32_t work_seconds) {
+    return -1;
+}
+
+
+int retained_load(retained_counters_t *counters) {
+    return -1;
+}
+
+
+int bus_activity_wait_idle(unsigned long timeout_ms) {
+    return 0;
+}
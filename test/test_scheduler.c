@@ -0,0 +1,236 @@
+/*
+ *  Host test of the deadline heap behind the event loop (main/utils/scheduler.c)
+ */
+#undef NDEBUG
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "utils/scheduler.h"
+
+
+#define NUM_TIMERS 32
+#define ROUNDS     2000
+// Close enough to the end of the range for the deadlines to wrap around
+#define WRAP_BASE (ULONG_MAX - 0xFFUL)
+
+
+static void test_ordering(void);
+static void test_rearm(void);
+static void test_cancel(void);
+static void test_capacity(void);
+static void test_next_delay(void);
+static void test_random_rounds(void);
+static void record(void *arg);
+
+
+static struct {
+    int    order[NUM_TIMERS * 2];
+    size_t count;
+} fired = {0};
+
+
+int main(void) {
+    test_ordering();
+    test_rearm();
+    test_cancel();
+    test_capacity();
+    test_next_delay();
+    test_random_rounds();
+    printf("test_scheduler: OK\n");
+    return 0;
+}
+
+
+/*
+ *  Timers expire by deadline, whatever the order they were armed in, also across the counter overflow
+ */
+static void test_ordering(void) {
+    const unsigned long bases[] = {0, WRAP_BASE};
+
+    for (size_t b = 0; b < sizeof(bases) / sizeof(bases[0]); b++) {
+        scheduler_t        scheduler;
+        scheduler_timer_t *heap[4];
+        scheduler_timer_t  timers[4];
+        unsigned long      base = bases[b];
+        scheduler_init(&scheduler, heap, 4);
+
+        const unsigned long offsets[] = {300, 100, 400, 200};
+        for (int i = 0; i < 4; i++) {
+            scheduler_timer_init(&timers[i], record, (void *)(intptr_t)i);
+            assert(scheduler_arm(&scheduler, &timers[i], base + offsets[i]) == 0);
+            assert(scheduler_is_armed(&timers[i]));
+        }
+
+        assert(scheduler_pop_expired(&scheduler, base + 99) == NULL);
+        assert(scheduler_pop_expired(&scheduler, base + 100) == &timers[1]);
+        assert(!scheduler_is_armed(&timers[1]));
+        assert(scheduler_pop_expired(&scheduler, base + 100) == NULL);
+
+        // Everything late is returned in deadline order
+        assert(scheduler_pop_expired(&scheduler, base + 1000) == &timers[3]);
+        assert(scheduler_pop_expired(&scheduler, base + 1000) == &timers[0]);
+        assert(scheduler_pop_expired(&scheduler, base + 1000) == &timers[2]);
+        assert(scheduler_pop_expired(&scheduler, base + 1000) == NULL);
+        assert(scheduler_next_delay(&scheduler, base) == SCHEDULER_NO_DEADLINE);
+    }
+}
+
+
+/*
+ *  Arming an armed timer moves it instead of adding it twice
+ */
+static void test_rearm(void) {
+    scheduler_t        scheduler;
+    scheduler_timer_t *heap[2];
+    scheduler_timer_t  first, second;
+    scheduler_init(&scheduler, heap, 2);
+    scheduler_timer_init(&first, record, NULL);
+    scheduler_timer_init(&second, record, NULL);
+
+    assert(scheduler_arm(&scheduler, &first, 100) == 0);
+    assert(scheduler_arm(&scheduler, &second, 200) == 0);
+
+    // Later, then earlier again; the heap is full but re-arming needs no new slot
+    assert(scheduler_arm(&scheduler, &first, 300) == 0);
+    assert(scheduler_next_delay(&scheduler, 0) == 200);
+    assert(scheduler_arm(&scheduler, &first, 50) == 0);
+    assert(scheduler_next_delay(&scheduler, 0) == 50);
+    assert(scheduler.count == 2);
+
+    assert(scheduler_pop_expired(&scheduler, 300) == &first);
+    assert(scheduler_pop_expired(&scheduler, 300) == &second);
+    assert(scheduler_pop_expired(&scheduler, 300) == NULL);
+
+    // A popped timer can be armed again
+    assert(scheduler_arm(&scheduler, &first, 400) == 0);
+    assert(scheduler_pop_expired(&scheduler, 400) == &first);
+}
+
+
+static void test_cancel(void) {
+    scheduler_t        scheduler;
+    scheduler_timer_t *heap[3];
+    scheduler_timer_t  timers[3];
+    scheduler_init(&scheduler, heap, 3);
+
+    for (int i = 0; i < 3; i++) {
+        scheduler_timer_init(&timers[i], record, NULL);
+        assert(scheduler_arm(&scheduler, &timers[i], 100 * (i + 1)) == 0);
+    }
+
+    // Head, then a timer that is not armed anymore
+    scheduler_cancel(&scheduler, &timers[0]);
+    assert(!scheduler_is_armed(&timers[0]));
+    scheduler_cancel(&scheduler, &timers[0]);
+    assert(scheduler.count == 2);
+    assert(scheduler_next_delay(&scheduler, 0) == 200);
+
+    scheduler_cancel(&scheduler, &timers[2]);
+    assert(scheduler_pop_expired(&scheduler, 1000) == &timers[1]);
+    assert(scheduler_pop_expired(&scheduler, 1000) == NULL);
+}
+
+
+static void test_capacity(void) {
+    scheduler_t        scheduler;
+    scheduler_timer_t *heap[2];
+    scheduler_timer_t  timers[3];
+    scheduler_init(&scheduler, heap, 2);
+
+    for (int i = 0; i < 3; i++) {
+        scheduler_timer_init(&timers[i], record, NULL);
+    }
+    assert(scheduler_arm(&scheduler, &timers[0], 10) == 0);
+    assert(scheduler_arm(&scheduler, &timers[1], 20) == 0);
+    assert(scheduler_arm(&scheduler, &timers[2], 30) == -1);
+    assert(!scheduler_is_armed(&timers[2]));
+
+    // A slot freed by a cancel is available again
+    scheduler_cancel(&scheduler, &timers[0]);
+    assert(scheduler_arm(&scheduler, &timers[2], 30) == 0);
+}
+
+
+/*
+ *  The delay is exact to the millisecond and never negative, also across the overflow
+ */
+static void test_next_delay(void) {
+    scheduler_t        scheduler;
+    scheduler_timer_t *heap[1];
+    scheduler_timer_t  timer;
+    scheduler_init(&scheduler, heap, 1);
+    scheduler_timer_init(&timer, record, NULL);
+
+    assert(scheduler_next_delay(&scheduler, 0) == SCHEDULER_NO_DEADLINE);
+
+    assert(scheduler_arm(&scheduler, &timer, WRAP_BASE + 0x200) == 0);
+    assert(scheduler_next_delay(&scheduler, WRAP_BASE) == 0x200);
+    assert(scheduler_next_delay(&scheduler, WRAP_BASE + 0x1FF) == 1);
+    assert(scheduler_next_delay(&scheduler, WRAP_BASE + 0x200) == 0);
+    assert(scheduler_next_delay(&scheduler, WRAP_BASE + 0x300) == 0);
+
+    assert(scheduler_pop_expired(&scheduler, WRAP_BASE + 0x1FF) == NULL);
+    assert(scheduler_pop_expired(&scheduler, WRAP_BASE + 0x200) == &timer);
+}
+
+
+/*
+ *  Random arms, re-arms and cancels around the overflow: following scheduler_next_delay every timer fires exactly
+ *  at its deadline and in order
+ */
+static void test_random_rounds(void) {
+    scheduler_t        scheduler;
+    scheduler_timer_t *heap[NUM_TIMERS];
+    scheduler_timer_t  timers[NUM_TIMERS];
+    unsigned long      deadlines[NUM_TIMERS];
+    scheduler_init(&scheduler, heap, NUM_TIMERS);
+    srand(1);
+
+    for (int round = 0; round < ROUNDS; round++) {
+        unsigned long base = WRAP_BASE - 250 + round % 500;
+        fired.count        = 0;
+
+        for (int i = 0; i < NUM_TIMERS; i++) {
+            scheduler_timer_init(&timers[i], record, (void *)(intptr_t)i);
+            deadlines[i] = base + rand() % 500;
+            assert(scheduler_arm(&scheduler, &timers[i], deadlines[i]) == 0);
+        }
+        for (int i = 0; i < 10; i++) {
+            int k        = rand() % NUM_TIMERS;
+            deadlines[k] = base + rand() % 500;
+            assert(scheduler_arm(&scheduler, &timers[k], deadlines[k]) == 0);
+        }
+        int cancelled = rand() % NUM_TIMERS;
+        scheduler_cancel(&scheduler, &timers[cancelled]);
+
+        unsigned long now = base;
+        for (;;) {
+            unsigned long delay = scheduler_next_delay(&scheduler, now);
+            if (delay == SCHEDULER_NO_DEADLINE) {
+                break;
+            }
+            now += delay;
+
+            scheduler_timer_t *timer = NULL;
+            while ((timer = scheduler_pop_expired(&scheduler, now)) != NULL) {
+                assert(timer->deadline == now);
+                timer->callback(timer->arg);
+            }
+        }
+
+        assert(fired.count == NUM_TIMERS - 1);
+        for (size_t i = 0; i < fired.count; i++) {
+            assert(fired.order[i] != cancelled);
+            if (i > 0) {
+                assert((long)(deadlines[fired.order[i]] - deadlines[fired.order[i - 1]]) >= 0);
+            }
+        }
+    }
+}
+
+
+static void record(void *arg) {
+    assert(fired.count < sizeof(fired.order) / sizeof(fired.order[0]));
+    fired.order[fired.count++] = (int)(intptr_t)arg;
+}